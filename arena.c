@@ -0,0 +1,88 @@
+#include "sever.h"
+
+/*
+ * 请求内存池：每个工作线程一个，为当前请求分配生命期与请求相同的临时内存
+ * （如解码后的表单字段），无需逐个释放。doit在每个请求开始时调用arena_reset
+ * 整体回收。池由若干块组成，回收时若有多块则合并为一块，稳定后每个请求都只用
+ * 一块内存，不再调用malloc。
+ */
+
+#define ARENA_BLOCK 4096 // 块的最小大小
+#define ARENA_ALIGN 16   // 分配的对齐字节数
+
+typedef struct arena_block
+{
+    struct arena_block *next; // 更早分配的块
+    size_t size, used;
+    char data[];
+} arena_block_t;
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+static void arena_destroy(void *arg)
+{
+    arena_block_t *b = arg, *next;
+
+    for (; b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+}
+
+static void arena_key_init(void)
+{
+    pthread_key_create(&arena_key, arena_destroy);
+}
+
+static arena_block_t *arena_block(size_t size, arena_block_t *next)
+{
+    arena_block_t *b = Malloc(sizeof(arena_block_t) + size);
+
+    b->next = next;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+/* arena_alloc - 从调用线程的请求内存池中分配n字节，在下一次arena_reset之前有效 */
+void *arena_alloc(size_t n)
+{
+    arena_block_t *b;
+    size_t size;
+    void *p;
+
+    pthread_once(&arena_once, arena_key_init);
+    b = pthread_getspecific(arena_key);
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (b == NULL || b->size - b->used < n) // 当前块放不下，新块至少是原来的两倍
+    {
+        size = b ? 2 * b->size : ARENA_BLOCK;
+        b = arena_block(n > size ? n : size, b);
+        pthread_setspecific(arena_key, b);
+    }
+    p = b->data + b->used;
+    b->used += n;
+    return p;
+}
+
+/* arena_reset - 回收调用线程在当前请求中分配的全部内存 */
+void arena_reset(void)
+{
+    arena_block_t *b;
+    size_t total = 0;
+
+    pthread_once(&arena_once, arena_key_init);
+    if ((b = pthread_getspecific(arena_key)) == NULL)
+        return;
+    if (b->next) // 上个请求用了多块，换成一块足够大的
+    {
+        for (; b; b = b->next)
+            total += b->size;
+        arena_destroy(pthread_getspecific(arena_key));
+        b = arena_block(total, NULL);
+        pthread_setspecific(arena_key, b);
+    }
+    b->used = 0;
+}
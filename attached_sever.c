@@ -1,343 +1,972 @@
-#include "csapp.h"
+#include "sever.h"
 
 /* 函数声明 */
-void doit(int fd); // 请求处理
+void read_requesthdrs(request_t *rq, const http_parser_t *hp); // 处理解析出的请求头部，记录连接管理所需的字段
 
-void read_requesthdrs(rio_t *rp); // 读取并忽略请求头部
+int parse_uri(const char *uri, char *filename, char *cgiargs); // 解码请求路径并取出查询串，路径非法时返回-1
 
-int parse_uri(const char *uri, char *filename, char *cgiargs); // 解析URI
-
-void serve_static(int fd, const char *filename, int filesize); // 处理静态内容请求
+void serve_static(request_t *rq, const char *filename, const struct stat *sbuf); // 处理静态内容请求
 
 void get_filetype(const char *filename, char *filetype); // 获取请求文件的MIME类型
 
-void serve_dynamic(int fd, const char *filename, const char *cgiargs); // 处理动态内容请求
+void serve_dynamic(request_t *rq, const char *filename, const char *cgiargs); // 处理动态内容请求
 
-void clienterror(int fd, const char *cause, const char *errnum, const char *shortmsg, const char *longmsg); // 发送错误响应给客户端
+/* 需要登录后才能访问的页面 */
+static const char *protected_pages[] = {"home.html", "add.html", NULL};
 
-void *handle_client(void *arg)
+/*
+ * 请求的文件是否需要登录后才能访问。先比较文件名，同名时再比较i节点，
+ * 使"//home.html"、"./x/../home.html"等写法也无法绕过。
+ */
+static int page_protected(const char *filename, const struct stat *sbuf)
 {
-    int fd = *(int *)arg;
+    const char *base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    struct stat pbuf;
+    int i;
 
-    pthread_t tid = pthread_self();        // 获取当前线程 ID
-    printf("Thread ID: %ld\n", (long)tid); // 打印当前线程号
+    for (i = 0; protected_pages[i]; i++)
+        if (!strcmp(base, protected_pages[i]) && stat(protected_pages[i], &pbuf) == 0 &&
+            pbuf.st_ino == sbuf->st_ino && pbuf.st_dev == sbuf->st_dev)
+            return 1;
+    return 0;
+}
 
-    pthread_detach(tid);
+/*
+ * 线程池任务：反应堆已把完整的请求头部读入c->rio并解析完毕。依次处理缓冲区中
+ * 所有完整的（流水线）请求，之后若连接仍可复用则交还反应堆，否则关闭连接。
+ */
+void handle_client(void *arg)
+{
+    conn_t *c = (conn_t *)arg;
 
-    doit(fd); // 调用doit函数处理客户端请求
-    close(fd);
-    return NULL;
+    do
+    {
+        if (!doit(c)) // 调用doit函数处理客户端请求，返回0表示不再复用连接
+        {
+            conn_close(c);
+            return;
+        }
+        http_parser_init(&c->parser);
+    } while (http_parse(&c->parser, c->rio.rio_bufptr, c->rio.rio_cnt) != 0); // 客户端流水线发送的下一个请求已在缓冲区中，不完整的部分由反应堆继续解析
+    conn_idle(c);
+}
+
+/* 记录访问日志与运行指标，返回keep */
+static int finish(const request_t *rq, const char *method, const char *target, const struct timespec *start, int keep)
+{
+    struct timespec now;
+    long usec;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usec = (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+    log_access(rq, method, target, usec);
+    metrics_request(rq->params.route, rq->status, usec);
+    metrics_add(M_BYTES_IN, rq->hdrs->headlen + rq->body.total);
+    metrics_add(M_BYTES_OUT, rq->bytes);
+    return keep;
+}
+
+/* 处理HTTP请求，返回值表示该连接能否继续处理下一个请求 */
+int doit(conn_t *c)
+{
+    request_t req, *rq = &req;      // 本次请求的处理上下文
+    rio_t *rp = &c->rio;            // 反应堆已填充好的读缓冲区
+    http_parser_t *hp = &c->parser; // 已解析的请求头部，各片段指向rp的缓冲区
+    const char *method, *uri;       // 请求方法与请求目标
+    handler_fn handler;             // 路由表中的处理程序
+    unsigned allow;                 // 路径存在但方法不符时可以使用的方法
+    struct timespec start;          // 开始处理的时刻，用于访问日志
+
+    char errnum[8];                           // 出错时应答的状态码
+    char filename[MAXLINE], cgiargs[MAXLINE]; // 定义字符数组用于存储解码后的请求路径和CGI参数
+
+    rq->conn = c;
+    rq->fd = c->fd;
+    rq->keepalive = 0;
+    rq->accept_enc = 1 << ENC_IDENTITY;
+    rq->sid[0] = '\0';
+    rq->sethdr[0] = '\0';
+    rq->path = "";
+    rq->params.route = -1;
+    rq->params.n = 0;
+    rq->hdrs = hp;
+    rq->body.total = 0; // body_begin之前出错时也要统计流量
+    rq->status = 0;
+    rq->bytes = 0;
+    c->nreq++;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    arena_reset(); // 回收上一个请求的临时内存
+
+    /* 请求头部已由解析器在缓冲区中原地切分好 */
+    rq->http11 = 0;
+    if (http_parse(hp, rp->rio_bufptr, rp->rio_cnt) <= 0) // 格式错误或超出限制，无法确定下一个请求的起点
+    {
+        snprintf(errnum, sizeof(errnum), "%d", hp->status);
+        clienterror(rq, "request", errnum, hp->reason, "Book sever couldn't parse the request");
+        return finish(rq, NULL, NULL, &start, 0);
+    }
+    rp->rio_bufptr += hp->headlen; // 头部已处理，缓冲区中随后是信息体或下一个请求
+    rp->rio_cnt -= hp->headlen;
+    method = hp->method.p;
+    uri = hp->target.p;
+
+    rq->http11 = hp->minor >= 1;
+    rq->keepalive = rq->http11; // HTTP/1.1默认保持连接，HTTP/1.0默认关闭
+    read_requesthdrs(rq, hp);   // 处理HTTP请求头部信息
+    if (c->nreq >= config.keepalive_max) // 达到单连接请求数上限，本次响应后关闭
+        rq->keepalive = 0;
+    if ((rq->method = http_method(method)) < 0) // 不认识的方法可能带有信息体，无法确定下一个请求的起点
+    {
+        rq->keepalive = 0;
+        clienterror(rq, method, "501", "Not Implemented", "Book sever does not implement this method");
+        return finish(rq, method, uri, &start, 0);
+    }
+    if (body_begin(&rq->body, rq) < 0) // 无法确定信息体的边界，应答后关闭连接
+    {
+        rq->keepalive = 0;
+        snprintf(errnum, sizeof(errnum), "%d", rq->body.status);
+        clienterror(rq, "request body", errnum, rq->body.reason, "Book sever couldn't read the request body");
+        return finish(rq, method, uri, &start, 0);
+    }
+    if (!rq->body.eof && config.log_level >= LOG_ACCESS) // 读取信息体会覆盖缓冲区中的请求行，日志用的副本放入请求内存池
+    {
+        uri = strcpy(arena_alloc(hp->target.len + 1), uri);
+        method = http_method_name(rq->method);
+    }
+
+    /* 读取信息体可能覆盖缓冲区中的请求头部，先取出路径与查询串 */
+    if (parse_uri(uri, filename, cgiargs) < 0)
+        clienterror(rq, "URI", "400", "Bad Request", "Book sever couldn't accept the request path");
+    else if ((rq->path = filename + 1, handler = route_lookup(rq->method, rq->path, &rq->params, &allow)) != NULL)
+        handler_run(handler, rq, cgiargs);
+    else if (allow) // 路径存在，但不接受该方法
+    {
+        snprintf(rq->sethdr, sizeof(rq->sethdr), "Allow: ");
+        route_allow(allow, rq->sethdr + 7, sizeof(rq->sethdr) - 7);
+        clienterror(rq, method, "405", "Method Not Allowed", "Book sever couldn't apply this method to the path");
+    }
+    else
+        clienterror(rq, filename, "404", "Not found", "Book couldn't find this file");
+
+    /*
+     * 丢弃处理程序未读的信息体，连接才能继续复用。客户端仍在等待100 Continue时
+     * 无法确定它是否还会发送信息体，只能关闭连接。
+     */
+    if (!rq->keepalive || (!rq->body.eof && (rq->body.expect || body_discard(&rq->body) < 0)))
+        return finish(rq, method, uri, &start, 0);
+    return finish(rq, method, uri, &start, rq->keepalive);
+}
+
+/* 读取并解码表单信息体，出错时已发送错误响应，返回-1 */
+static int read_form(request_t *rq, form_t *data)
+{
+    size_t length;
+    char *form; // 表单内容
+    char errnum[8];
+
+    if (rq->body.length < 0 && !rq->body.chunked) // 表单请求必须给出长度
+    {
+        clienterror(rq, rq->path, "411", "Length Required", "Book sever couldn't read the form");
+        return -1;
+    }
+    if ((form = body_buffer(&rq->body, &length)) == NULL) // 按Content-Length或分块编码精确读取信息体，不越界读到下一个请求
+    {
+        rq->keepalive = 0;
+        snprintf(errnum, sizeof(errnum), "%d", rq->body.status);
+        clienterror(rq, rq->path, errnum, rq->body.reason, "Book sever couldn't read the form");
+        return -1;
+    }
+    if (form_parse(data, form, length) < 0)
+    {
+        clienterror(rq, "表单字段过多！！！", "400", "Bad Request", "请求失败");
+        return -1;
+    }
+    return 0;
 }
 
-/* 处理HTTP请求 */
-void doit(int fd)
+// GET "/*"：静态内容，路径以'/'结尾时取该目录下的index.html
+static void route_static(request_t *rq, const char *query, response_t *resp)
 {
-    int is_static;    // 标记是否为静态内容请求
+    char filename[MAXLINE];
     struct stat sbuf; // 标记文件状态
 
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE]; // 定义字符数组用于存储HTTP请求的内容
-    char filename[MAXLINE], cgiargs[MAXLINE];                           // 定义字符数组用于存储服务器上要读取或执行的文件名和CGI参数
-    rio_t rio;                                                          // 定义一个rio结构体，用于读取HTTP请求的内容
+    resp->sent = 1; // 响应由clienterror、redirect或serve_static发送
+    snprintf(filename, sizeof(filename), ".%s%s", rq->path, rq->path[strlen(rq->path) - 1] == '/' ? "index.html" : "");
+    if (stat(filename, &sbuf) < 0) // 获取文件状态结构体，如果失败，返回404状态码
+    {
+        clienterror(rq, filename, "404", "Not found", "Book couldn't find this file");
+        return;
+    }
+    if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有读取该文件的权限
+    {
+        clienterror(rq, filename, "403", "Forbidden", "Book sever couldn't read the file");
+        return;
+    }
+    if (page_protected(filename, &sbuf) && !session_check(rq->sid, NULL)) // 受保护页面凭会话访问，无需查询数据库
+    {
+        redirect(rq, "/index.html");
+        return;
+    }
+    serve_static(rq, filename, &sbuf); // 处理静态内容请求
+}
+
+// GET "/calculate/*"：CGI程序，只有启用了外部CGI时才运行，程序文件本身不作为静态内容提供
+static void route_cgi(request_t *rq, const char *query, response_t *resp)
+{
+    char filename[MAXLINE];
+    struct stat sbuf;
+
+    resp->sent = 1;
+    snprintf(filename, sizeof(filename), ".%s", rq->path);
+    if (!config.cgi)
+    {
+        clienterror(rq, filename, "404", "Not found", "Book couldn't find this file");
+        return;
+    }
+    if (stat(filename, &sbuf) < 0 || !(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有执行该文件的权限
+    {
+        clienterror(rq, filename, "403", "Forbidden", "Book sever couldn't run the CGI program");
+        return;
+    }
+    serve_dynamic(rq, filename, query); // 处理动态内容请求
+}
+
+/* GET "/logout"：退出登录，删除会话并让浏览器丢弃Cookie */
+static void route_logout(request_t *rq, const char *query, response_t *resp)
+{
+    resp->sent = 1;
+    session_destroy(rq->sid);
+    strcpy(rq->sethdr, "Set-Cookie: sid=; Path=/; Max-Age=0");
+    redirect(rq, "/index.html");
+}
+
+/* POST "/home.html"：登录，成功后创建会话并返回主页 */
+static void route_login(request_t *rq, const char *query, response_t *resp)
+{
+    db_t *db;
+    sqlite3_stmt *stmt;
+    char token[SESSION_TOKEN_LEN + 1]; // 新建会话的令牌
+    char filename[MAXLINE];
+    struct stat sbuf;
+    form_t data; // 解码后的表单字段
+    const char *user, *pass;
+
+    resp->sent = 1;
+    if (read_form(rq, &data) < 0)
+        return;
+    if ((db = db_get()) == NULL) // 取得本线程的数据库连接
+    {
+        clienterror(rq, "数据库不可用！！！", "500", "Internal Server Error", "请求失败");
+        return;
+    }
+
+    /* 在表单中查找用户名和密码 */
+    user = form_get(&data, "username");
+    pass = form_get(&data, "password");
+    if (user == NULL || pass == NULL)
+    {
+        clienterror(rq, "服务器未能识别用户名或密码！！！", "400", "Bad Request", "请求失败");
+        return;
+    }
+    if ((stmt = db_stmt(db, DB_LOGIN)) == NULL) // 取出缓存的查询语句
+    {
+        clienterror(rq, "服务器错误！！！", "500", "Internal Server Error", "登录失败");
+        return;
+    }
 
-    Rio_readinitb(&rio, fd); // 初始化rio结构体
+    /* 绑定参数 */
+    sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, pass, -1, SQLITE_STATIC);
 
-    /* 解析请求行 */
-    if (!Rio_readlineb(&rio, buf, MAXLINE)) // 读取HTTP请求的第一行，如果没有读到数据，直接返回
+    if (db_step(stmt) != SQLITE_ROW) // 若未查询到账号或密码
+    {
+        clienterror(rq, "用户名或密码错误！！！", "401", "Unauthorized", "登录失败");
         return;
-    printf("%s", buf);                             // 在服务器上打印HTTP请求行
-    sscanf(buf, "%s %s %s", method, uri, version); // 解析HTTP请求行，将请求行的三个元素分别存储到method、uri、version数组中
+    }
 
-    if (!strcasecmp(method, "GET")) // HTTP请求方法为GET
+    /* 登录成功，创建会话，之后访问受保护页面只需出示Cookie */
+    if (session_create(user, token) == 0)
+        snprintf(rq->sethdr, sizeof(rq->sethdr), "Set-Cookie: sid=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Lax",
+                 token, config.session_ttl);
+
+    snprintf(filename, sizeof(filename), ".%s", rq->path);
+    if (stat(filename, &sbuf) < 0) // 获取文件状态结构体，如果失败，返回404状态码
     {
-        read_requesthdrs(&rio); // 读取HTTP请求头部信息
+        clienterror(rq, filename, "404", "Not Found", "Book sever couldn't find this file");
+        return;
+    }
+    if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有读取该文件的权限
+    {
+        clienterror(rq, filename, "409", "Forbidden", "Book sever couldn't read the file");
+        return;
+    }
+    serve_static(rq, filename, &sbuf); // 作为静态文件处理
+}
 
-        is_static = parse_uri(uri, filename, cgiargs); // 解析URI，获取文件名和CGI参数，根据返回值判断请求是否为静态内容请求
+/* POST "/user.html"：注册新用户 */
+static void route_register(request_t *rq, const char *query, response_t *resp)
+{
+    db_t *db;
+    sqlite3_stmt *stmt;
+    struct stat sbuf;
+    form_t data;
+    const char *user, *pass, *em, *em_su;
+    const char *filename = "register_success.html";
+    char *email;
+    int rc;
 
-        if (is_static) // 处理静态内容请求
-        {
-            if (stat(filename, &sbuf) < 0) // 获取文件状态结构体，如果失败，返回404状态码
-            {
-                clienterror(fd, filename, "404", "Not found", "Book couldn't find this file");
-                return;
-            }
-            if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有读取该文件的权限
-            {
-                clienterror(fd, filename, "403", "Forbidden", "Book sever couldn't read the file");
-                return;
-            }
-            serve_static(fd, filename, sbuf.st_size); // 处理静态内容请求
-        }
-        else // 处理动态内容请求
-        {
-            // if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有读取该文件的权限
-            // {
-            //     clienterror(fd, filename, "403", "Forbidden", "Book sever couldn't run the CGI program");
-            //     return;
-            // }
-            serve_dynamic(fd, filename, cgiargs); // 处理动态内容请求
-        }
+    resp->sent = 1;
+    if (read_form(rq, &data) < 0)
+        return;
+    if ((db = db_get()) == NULL)
+    {
+        clienterror(rq, "数据库不可用！！！", "500", "Internal Server Error", "请求失败");
+        return;
+    }
+
+    /* 在表单中查找用户名、密码、邮箱名、邮箱后缀 */
+    user = form_get(&data, "username");
+    pass = form_get(&data, "password");
+    em = form_get(&data, "emailname");
+    em_su = form_get(&data, "email_suffix"); // 如"@qq.com"，表单中的'@'已由解码器还原
+    if (!(user && pass && em && em_su && *user && *pass)) // 查找失败
+    {
+        clienterror(rq, "服务器未解析到用户名、密码或邮箱！！！", "400", "Bad Request", "请求失败");
+        return;
+    }
+
+    /* 拼接邮箱 */
+    email = arena_alloc(strlen(em) + strlen(em_su) + 2);
+    sprintf(email, "%s%s%s", em, *em_su == '@' ? "" : "@", em_su);
+
+    if ((stmt = db_stmt(db, DB_USER_EXISTS)) == NULL) // 取出缓存的查询语句，判断该用户是否已存在
+    {
+        clienterror(rq, "服务器错误！！！", "500", "Internal Server Error", "注册失败");
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC); // 绑定参数
+    if (db_step(stmt) == SQLITE_ROW) // 若用户已存在
+    {
+        clienterror(rq, "该用户已存在！！！", "409", "Conflict", "注册失败");
+        return;
     }
-    else if (!strcasecmp(method, "POST")) // HTTP请求方法为POST
+
+    rc = SQLITE_ERROR;
+    if ((stmt = db_stmt(db, DB_USER_INSERT)) != NULL) // 取出缓存的插入语句
     {
-        sqlite3 *db;
-        char *err_msg = NULL;
-        int rc, n;
+        /* 绑定参数 */
+        sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, pass, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, email, -1, SQLITE_STATIC);
+
+        rc = db_step(stmt);
+    }
+    if (rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "无法执行 SQL 语句: %s\n", db_errmsg(db));
+        clienterror(rq, "服务器错误！！！", "500", "Internal Server Error", "注册失败");
+        return;
+    }
+    stat(filename, &sbuf);
+    serve_static(rq, filename, &sbuf);
+}
+
+/*
+ * routes_init - 注册站点的路由，须在handler_init与fcgi_init之前调用，
+ *    使它们注册的同名路由覆盖这里的默认处理。
+ */
+void routes_init(void)
+{
+    route_add(ROUTE_GET, "/*", route_static);
+    route_add(ROUTE_GET, "/calculate/*", route_cgi);
+    route_add(ROUTE_GET, "/logout", route_logout);
+    route_add(ROUTE_POST, "/home.html", route_login);
+    route_add(ROUTE_POST, "/user.html", route_register);
+}
 
-        char *type = NULL;
-        int length;
-        char *username = NULL, *password = NULL, *email = NULL, *email_suffix = NULL;
+/* 从Cookie头部的值中取出名为sid的会话令牌 */
+static void parse_cookie(request_t *rq, const char *v)
+{
+    size_t len;
 
-        /* 打开数据库 */
-        if (rc = sqlite3_open("userinfo.db", &db) != SQLITE_OK)
+    for (; *v; v += strcspn(v, ";"))
+    {
+        v += strspn(v, "; \t");
+        if (strncmp(v, "sid=", 4))
+            continue;
+        v += 4;
+        if ((len = strcspn(v, "; \t")) == SESSION_TOKEN_LEN)
         {
-            fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-            sqlite3_close(db);
-            exit(1);
+            memcpy(rq->sid, v, len);
+            rq->sid[len] = '\0';
         }
+    }
+}
+
+/* 根据请求头部表记录Connection、Accept-Encoding与会话令牌，信息体的长度由body_begin处理 */
+void read_requesthdrs(request_t *rq, const http_parser_t *hp)
+{
+    const char *v; // 解析器已去掉值两端的空白
+
+    if ((v = http_header(hp, HDR_CONNECTION)) != NULL) // 客户端显式指定是否保持连接
+    {
+        if (!strncasecmp(v, "close", 5))
+            rq->keepalive = 0;
+        else if (!strncasecmp(v, "keep-alive", 10))
+            rq->keepalive = 1;
+    }
+    if ((v = http_header(hp, HDR_ACCEPT_ENCODING)) != NULL) // 客户端支持的压缩格式
+        rq->accept_enc = encoding_parse(v);
+    if ((v = http_header(hp, HDR_COOKIE)) != NULL) // 取出会话令牌
+        parse_cookie(rq, v);
+}
+
+// 解析URI并将解析结果存储到filename和cgiargs指向的字符串中
+// 参数uri是待解析的URI字符串
+// 参数filename是存储解码后的请求路径（以"."开头）的字符串指针
+// 参数cgiargs是存储解析出来的CGI参数的字符串指针
+// 返回值为0；路径解码后含有'\0'或".."段时返回-1。路径由哪个处理程序负责由路由表决定
+int parse_uri(const char *uri, char *filename, char *cgiargs)
+{
+    const char *ptr, *seg;
+    size_t len, n;
+
+    ptr = strchr(uri, '?'); // 在URI中定位"?"字符的位置
+    len = ptr ? (size_t)(ptr - uri) : strlen(uri);
+    strcpy(cgiargs, ptr ? ptr + 1 : "");    // 把"?"后面的部分原样作为CGI参数保存下来，由使用者按需解码
+    strcpy(filename, ".");                  // 将"."作为文件路径的起始点
+    n = url_decode(filename + 1, uri, len); // 将URI中"?"之前的部分解码后拼接到文件路径后面
 
-        /* 读取HTTP请求的信息体 */
-        for (;;)
+    if (strlen(filename + 1) != n) // 解码出的'\0'会截断文件名
+        return -1;
+    if (filename[1] != '/') // 只接受以'/'开头的路径，"?x"之类的空路径与相对路径都是非法请求
+        return -1;
+    for (seg = filename + 1; (seg = strstr(seg, "/..")) != NULL; seg += 3) // 不允许访问网站目录之外的文件
+        if (seg[3] == '/' || seg[3] == '\0')
+            return -1;
+    return 0;
+}
+
+/* 按文件名决定的Cache-Control策略，先匹配的优先；文件名以后缀匹配 */
+static const struct
+{
+    const char *suffix;
+    const char *policy;
+} cache_policies[] = {
+    {".html", "no-cache"},               // 页面每次都向服务器验证，未修改时得到304
+    {".jpg", "public, max-age=604800"},  // 图片缓存一周
+    {".png", "public, max-age=604800"},
+    {".gif", "public, max-age=604800"},
+    {".ico", "public, max-age=2592000"}, // 图标缓存30天
+    {NULL, NULL}};
+
+/* 文件的Cache-Control值：受保护页面只允许浏览器私有缓存，且每次验证 */
+static const char *cache_policy(const char *filename)
+{
+    const char *base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    size_t len = strlen(filename), n;
+    int i;
+
+    for (i = 0; protected_pages[i]; i++)
+        if (!strcmp(base, protected_pages[i]))
+            return "private, no-cache";
+    for (i = 0; cache_policies[i].suffix; i++)
+        if ((n = strlen(cache_policies[i].suffix)) <= len && !strcasecmp(filename + len - n, cache_policies[i].suffix))
+            return cache_policies[i].policy;
+    return "no-cache";
+}
+
+/*
+ * 构造文件的验证与缓存头部（每行以\r\n结尾），返回其长度。编码后的版本是不同的表示，
+ * 强ETag须互不相同，因此在哈希后附加编码名；etag为空串时不输出ETag。
+ */
+static int validator_header(char *buf, size_t size, const char *filename, const char *etag, int enc, time_t mtime)
+{
+    struct tm tm;
+    int n = 0;
+
+    if (etag[0] && enc != ENC_IDENTITY)
+        n += snprintf(buf, size, "ETag: %.17s-%s\"\r\n", etag, encoding_name(enc));
+    else if (etag[0])
+        n += snprintf(buf, size, "ETag: %s\r\n", etag);
+    gmtime_r(&mtime, &tm);
+    n += strftime(buf + n, size - n, "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    n += snprintf(buf + n, size - n, "Cache-Control: %s\r\n", cache_policy(filename));
+    return n;
+}
+
+/* 解析IMF-fixdate格式的HTTP日期（如"Sun, 06 Nov 1994 08:49:37 GMT"），格式不符返回-1 */
+static time_t http_date(const char *s)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char wday[4], mon[4];
+    const char *p;
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(s, "%3s, %d %3s %d %d:%d:%d GMT", wday, &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min,
+               &tm.tm_sec) != 7 ||
+        (p = strstr(months, mon)) == NULL || (p - months) % 3)
+        return -1;
+    tm.tm_mon = (p - months) / 3;
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+/* If-None-Match的值中是否有与etag相同的实体标签；弱比较，忽略W/前缀与编码后缀 */
+static int etag_match(const char *list, const char *etag)
+{
+    size_t len;
+
+    for (; *list; list += strcspn(list, ","))
+    {
+        list += strspn(list, ", \t");
+        if (*list == '*')
+            return 1;
+        if (!strncmp(list, "W/", 2))
+            list += 2;
+        len = strcspn(list, ", \t");
+        if (len >= 18 && !strncmp(list, etag, 17) && (list[17] == '"' || list[17] == '-'))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * 客户端缓存的版本是否仍然有效，只用于GET。有If-None-Match时只看它，
+ * 否则比较If-Modified-Since与文件的修改时间（HTTP日期精确到秒）。
+ */
+static int not_modified(request_t *rq, const char *etag, time_t mtime)
+{
+    const char *v;
+    time_t since;
+
+    if (rq->method != HTTP_GET)
+        return 0;
+    if ((v = http_header(rq->hdrs, HDR_IF_NONE_MATCH)) != NULL)
+        return etag[0] && etag_match(v, etag);
+    if ((v = http_header(rq->hdrs, HDR_IF_MODIFIED_SINCE)) != NULL && (since = http_date(v)) != -1)
+        return mtime <= since;
+    return 0;
+}
+
+/* 应答304：只有头部，与200响应携带相同的验证与缓存头部 */
+static void send_not_modified(request_t *rq, const char *filename, const char *etag, int enc, time_t mtime)
+{
+    char hdr[MAXLINE], filetype[MAXLINE];
+    response_t resp;
+    int n;
+
+    resp_init(&resp, rq, 304, "Not Modified");
+    n = validator_header(hdr, sizeof(hdr), filename, etag, enc, mtime);
+    resp_header(&resp, "%.*s", n - 2, hdr);
+    get_filetype(filename, filetype);
+    if (encoding_compressible(filetype))
+        resp_header(&resp, "Vary: Accept-Encoding");
+    if (rq->sethdr[0])
+        resp_header(&resp, "%s", rq->sethdr);
+    resp_send(&resp);
+}
+
+/*
+ * 字节范围请求。每个范围在多段响应中占一个分隔头部段和一个正文段，另有一个结尾段，
+ * 因此一个响应最多容纳(RESP_MAXSEGS - 1) / 2个范围；合并重叠范围后仍超出时忽略Range，
+ * 按完整的200应答，也避免了用大量小范围放大服务器开销的请求。
+ */
+#define RANGE_MAX ((RESP_MAXSEGS - 1) / 2)
+
+typedef struct
+{
+    off_t first, last; // 闭区间
+} range_t;
+
+static int range_cmp(const void *a, const void *b)
+{
+    const range_t *x = a, *y = b;
+
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/* 读一个非负十进制数，没有数字或溢出时返回-1 */
+static off_t range_num(const char **s)
+{
+    off_t v = 0;
+
+    if (!isdigit((unsigned char)**s))
+        return -1;
+    for (; isdigit((unsigned char)**s); (*s)++)
+        if ((v = v * 10 + (**s - '0')) > ((off_t)1 << 53))
+            return -1;
+    return v;
+}
+
+/*
+ * 解析Range的值（bytes=a-b、bytes=a-、bytes=-n，以逗号分隔），按文件大小size截断并
+ * 合并重叠或相邻的范围。返回范围数；全部不可满足时返回0；语法错误、不是字节单位或
+ * 范围过多时返回-1，此时应忽略Range。
+ */
+static int range_parse(const char *v, off_t size, range_t *ranges)
+{
+    range_t r[RANGE_MAX * 4];
+    off_t first, last;
+    int i, n = 0, m;
+
+    if (strncasecmp(v, "bytes=", 6))
+        return -1;
+    for (v += 6;; v++)
+    {
+        v += strspn(v, " \t");
+        if (*v == '-') // 最后n个字节
         {
-            Rio_readlineb(&rio, buf, MAXLINE);
-            printf("%s", buf);                           // 打印读取的行
-            if (!strcmp(buf, "\r\n"))
-                break;
-            if (strstr(buf, "Content-Length: ") != NULL) // 抓取接收的表单长度
-            {
-                char *temp;
-                type = index(buf, ':'); // 在buf中定位":"字符的位置
-                strcpy(temp, type + 2); // 把": "后面的部分保存下来(注意：有个空格)
-                length = atoi(temp);
-            }
+            v++;
+            if ((last = range_num(&v)) < 0)
+                return -1;
+            first = last < size ? size - last : 0;
+            last = last > 0 ? size - 1 : -1;
         }
-        Rio_readlineb(&rio, buf, length + 1); // 读取HTTP请求的最后一行,即用户信息
-        printf("%s\n\n", buf);
-
-        if (!strcmp(uri, "/home.html"))
+        else
         {
-            /* 在 HTTP 请求中查找用户名和密码 */
-            username = strstr(buf, "username=");
-            password = strstr(buf, "password=");
-
-            if (username && password) // 如果在请求表单中找到了用户名和密码
-            {
-                /* 解析表单信息，提取用户名和密码 */
-                char *user = strtok(username, "=");
-                user = strtok(NULL, "&");
-
-                char *pass = strtok(password, "=");
-                pass = strtok(NULL, "&");
-
-                char *sql1 = "SELECT * FROM users WHERE username=? AND password=?;"; // 构造查询语句
-                sqlite3_stmt *stmt;
-                sqlite3_prepare_v2(db, sql1, -1, &stmt, NULL); // 编译查询语句
-
-                /* 绑定参数 */
-                sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
-                sqlite3_bind_text(stmt, 2, pass, -1, SQLITE_STATIC);
-
-                rc = sqlite3_step(stmt); // 执行sql查询语句
-                sqlite3_finalize(stmt);  // 释放占用资源
-
-                if (rc != SQLITE_ROW) // 若未查询到账号或密码
-                {
-                    clienterror(fd, "用户名或密码错误！！！", "401", "Unauthorized", "登录失败");
-                    return;
-                }
-            }
-            else
-            {
-                clienterror(fd, "服务器未能识别用户名或密码！！！", "400", "Bad Request", "请求失败");
-                return;
-            }
-
-            parse_uri(uri, filename, cgiargs); // 解析URI，获取文件名
-
-            if (stat(filename, &sbuf) < 0) // 获取文件状态结构体，如果失败，返回404状态码
-            {
-                clienterror(fd, filename, "404", "Not Found", "Book sever couldn't find this file");
-                return;
-            }
-            if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) // 判断文件是否为普通文件,并且当前用户是否拥有读取该文件的权限
-            {
-                clienterror(fd, filename, "409", "Forbidden", "Book sever couldn't read the file");
-                return;
-            }
-            serve_static(fd, filename, sbuf.st_size); // 作为静态文件处理
+            if ((first = range_num(&v)) < 0 || *v++ != '-')
+                return -1;
+            last = size - 1;
+            if (isdigit((unsigned char)*v) && ((last = range_num(&v)) < first))
+                return -1;
+            if (last >= size)
+                last = size - 1;
         }
-        else if (!strcmp(uri, "/user.html"))
+        if (first <= last) // 不可满足的范围（起点超出文件末尾）直接跳过
         {
-            /* 在 HTTP 请求中查找用户名、密码、邮箱名、邮箱后缀 */
-            username = strstr(buf, "username=");
-            password = strstr(buf, "password=");
-            email = strstr(buf, "emailname=");
-            email_suffix = strstr(buf, "email_suffix=");
-
-            if (username && password && email && email_suffix)
-            {
-                char *user = strtok(username, "=");
-                user = strtok(NULL, "&");
-
-                char *pass = strtok(password, "=");
-                pass = strtok(NULL, "&");
-
-                char *em = strtok(email, "=");
-                em = strtok(NULL, "&");
-
-                /* 测过程试中发现无法识别‘@’符号，‘@’符号被转为‘%40’，于是由服务器进行截取拼接处理*/
-                char *em_su = strtok(email_suffix, "=");
-                em_su = strtok(NULL, "&");
-                strcpy(em_su, em_su + 3);
-
-                /* 拼接邮箱 */
-                strcat(em, "@");
-                strcat(em, em_su);
-
-                char *sql2 = "SELECT * FROM users WHERE username=?;"; // 构造查询语句，判断该用户是否已存在
-                sqlite3_stmt *stmt1;
-                if (rc = sqlite3_prepare_v2(db, sql2, -1, &stmt1, NULL) != SQLITE_OK) // 编译查询语句
-                {
-                    fprintf(stderr, "无法编译 SQL 语句: %s\n", sqlite3_errmsg(db));
-                    sqlite3_close(db);
-                }
-                sqlite3_bind_text(stmt1, 1, user, -1, SQLITE_STATIC); // 绑定参数
-
-                rc = sqlite3_step(stmt1); // 执行查询
-                sqlite3_finalize(stmt1);  // 释放占用资源
-
-                if (rc != SQLITE_ROW) // 若用户已存在
-                {
-                    char *sql3 = "INSERT INTO users (username, password, email) VALUES (?, ?, ?)"; // 构建 SQL 语句
-                    sqlite3_stmt *stmt2;
-
-                    if (rc = sqlite3_prepare_v2(db, sql3, -1, &stmt2, NULL) != SQLITE_OK) // 编译插入语句
-                    {
-                        fprintf(stderr, "无法编译 SQL 语句: %s\n", sqlite3_errmsg(db));
-                        sqlite3_close(db);
-                    }
-
-                    /* 绑定参数 */
-                    sqlite3_bind_text(stmt2, 1, user, -1, SQLITE_STATIC);
-                    sqlite3_bind_text(stmt2, 2, pass, -1, SQLITE_STATIC);
-                    sqlite3_bind_text(stmt2, 3, em, -1, SQLITE_STATIC);
-
-                    rc = sqlite3_step(stmt2);
-                    sqlite3_finalize(stmt2);
-
-                    if (rc != SQLITE_DONE)
-                    {
-                        fprintf(stderr, "无法执行 SQL 语句: %s\n", sqlite3_errmsg(db));
-                        sqlite3_close(db);
-                        clienterror(fd, "服务器错误！！！", "500", "Internal Server Error", "注册失败");
-                        return;
-                    }
-                    else
-                    {
-                        strcpy(filename, "register_success.html");
-                        stat(filename, &sbuf);
-                        serve_static(fd, filename, sbuf.st_size);
-                    }
-                }
-                else
-                {
-                    clienterror(fd, "该用户已存在！！！", "409", "Conflict", "注册失败");
-                    return;
-                }
-            }
-            else
-            { // 查找失败
-                clienterror(fd, "服务器未解析到用户名、密码或邮箱！！！", "400", "Bad Request", "请求失败");
-                return;
-            }
+            if (n == RANGE_MAX * 4)
+                return -1;
+            r[n].first = first;
+            r[n++].last = last;
         }
-        else
+        v += strspn(v, " \t");
+        if (*v == '\0')
+            break;
+        if (*v != ',')
+            return -1;
+    }
+
+    qsort(r, n, sizeof(range_t), range_cmp);
+    for (i = 0, m = 0; i < n; i++)
+    {
+        if (m > 0 && r[i].first <= ranges[m - 1].last + 1)
         {
-            clienterror(fd, uri, "404", "Not Found", "Book sever couldn't find this file");
-            return;
+            if (r[i].last > ranges[m - 1].last)
+                ranges[m - 1].last = r[i].last;
+            continue;
         }
+        if (m == RANGE_MAX)
+            return -1;
+        ranges[m++] = r[i];
+    }
+    return m;
+}
+
+/*
+ * 请求要求的字节范围，只用于GET。If-Range与当前版本不符（实体标签须强匹配，
+ * 日期须与Last-Modified相同）时返回-1，应发送完整的文件；其余返回值同range_parse。
+ */
+static int range_request(request_t *rq, const char *etag, const struct stat *sbuf, range_t *ranges)
+{
+    const char *v;
+
+    if (rq->method != HTTP_GET || (v = http_header(rq->hdrs, HDR_RANGE)) == NULL)
+        return -1;
+    if ((v = http_header(rq->hdrs, HDR_IF_RANGE)) != NULL &&
+        (v[0] == '"' || !strncmp(v, "W/", 2) ? !etag[0] || strcmp(v, etag) : http_date(v) != sbuf->st_mtime))
+        return -1;
+    return range_parse(http_header(rq->hdrs, HDR_RANGE), sbuf->st_size, ranges);
+}
+
+/* 206与416响应中与同一文件的200响应相同的头部：Vary、验证与缓存头部 */
+static void range_headers(response_t *resp, const char *filename, const char *filetype, const struct stat *sbuf,
+                          const char *etag)
+{
+    char hdr[MAXLINE];
+
+    if (encoding_compressible(filetype)) // 同一资源的各响应须给出相同的Vary，缓存才不会混用不同编码的版本
+        resp_header(resp, "Vary: Accept-Encoding");
+    resp_header(resp, "Accept-Ranges: bytes");
+    resp_header(resp, "%.*s", validator_header(hdr, sizeof(hdr), filename, etag, ENC_IDENTITY, sbuf->st_mtime) - 2,
+                hdr);
+    if (resp->rq->sethdr[0])
+        resp_header(resp, "%s", resp->rq->sethdr);
+}
+
+/*
+ * 应答206：正文取自内存中的body，body为NULL时取自文件描述符fd，经由sendfile发送。
+ * 多个范围组成multipart/byteranges，每段前有各自的Content-type与Content-Range。
+ */
+static void send_ranges(request_t *rq, const char *filename, const struct stat *sbuf, const char *etag,
+                        const char *body, int fd, const range_t *ranges, int n)
+{
+    char filetype[MAXLINE], boundary[32];
+    response_t resp;
+    int i;
+
+    get_filetype(filename, filetype);
+    resp_init(&resp, rq, 206, "Partial Content");
+    range_headers(&resp, filename, filetype, sbuf, etag);
+    if (n == 1)
+    {
+        resp_header(&resp, "Content-type: %s", filetype);
+        resp_header(&resp, "Content-Range: bytes %lld-%lld/%lld", (long long)ranges[0].first,
+                    (long long)ranges[0].last, (long long)sbuf->st_size);
     }
     else
     {
-        /* 未知请求 */
-        clienterror(fd, method, "501", "Not Implemented", "Book sever does not implement this method");
-        return;
+        snprintf(boundary, sizeof(boundary), "BOOK%.16s%08lx", etag[0] ? etag + 1 : "", (unsigned long)random());
+        resp_header(&resp, "Content-type: multipart/byteranges; boundary=%s", boundary);
     }
+    for (i = 0; i < n; i++)
+    {
+        if (n > 1)
+            resp_bodyf(&resp, "%s--%s\r\nContent-type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                       i ? "\r\n" : "", boundary, filetype, (long long)ranges[i].first, (long long)ranges[i].last,
+                       (long long)sbuf->st_size);
+        if (body)
+            resp_body(&resp, body + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+        else
+            resp_file(&resp, fd, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    if (n > 1)
+        resp_bodyf(&resp, "\r\n--%s--\r\n", boundary);
+    resp_send(&resp);
+}
+
+/* 应答416：没有一个范围落在文件之内 */
+static void send_unsatisfiable(request_t *rq, const char *filename, const struct stat *sbuf, const char *etag)
+{
+    char filetype[MAXLINE];
+    response_t resp;
+
+    get_filetype(filename, filetype);
+    resp_init(&resp, rq, 416, "Range Not Satisfiable");
+    range_headers(&resp, filename, filetype, sbuf, etag);
+    resp_header(&resp, "Content-Range: bytes */%lld", (long long)sbuf->st_size);
+    resp_send(&resp);
 }
 
-void read_requesthdrs(rio_t *rp)
+/* 构造静态文件响应头部（不含Connection行和结尾空行），返回其长度 */
+static int static_header(char *buf, size_t size, const char *filename, const char *filetype, off_t filesize, int enc,
+                         const char *etag, time_t mtime)
 {
-    char buf[MAXLINE];
+    int n;
+
+    n = snprintf(buf, size,
+                 "HTTP/1.1 200 OK\r\n"         // 状态行
+                 "Server: Book Web Server\r\n" // 服务器信息
+                 "Content-length: %lld\r\n"    // 文件长度
+                 "Content-type: %s\r\n"        // 文件类型
+                 "Accept-Ranges: bytes\r\n",    // 支持断点续传
+                 (long long)filesize, filetype);
+    if (encoding_compressible(filetype)) // 响应内容随Accept-Encoding变化，提示中间缓存分别保存
+        n += snprintf(buf + n, size - n, "Vary: Accept-Encoding\r\n");
+    if (enc != ENC_IDENTITY)
+        n += snprintf(buf + n, size - n, "Content-Encoding: %s\r\n", encoding_name(enc));
+    n += validator_header(buf + n, size - n, filename, etag, enc, mtime);
+    return n;
+}
 
-    Rio_readlineb(rp, buf, MAXLINE); // 读取HTTP请求的第二行
-    printf("%s", buf);               // 打印输出读取的第二行
-    while (strcmp(buf, "\r\n"))      // 判断当前请求行是否为单独的换行符，以表示当前请求命令输入完
+/* 为编码enc的正文生成缓存版本，body为NULL表示该版本不存在 */
+static void cache_variant(cache_variant_t *v, const char *filename, const char *filetype, int enc, char *body,
+                          size_t bodylen, const char *etag, time_t mtime)
+{
+    char hdr[MAXBUF];
+
+    v->body = body;
+    v->bodylen = body ? bodylen : 0;
+    v->hdr = NULL;
+    v->hdrlen = 0;
+    if (body)
     {
-        Rio_readlineb(rp, buf, MAXLINE); // 继续读取HTTP请求的下一行
-        printf("%s", buf);               // 打印输出读取的行
+        v->hdrlen = static_header(hdr, sizeof(hdr), filename, filetype, bodylen, enc, etag, mtime);
+        v->hdr = strdup(hdr);
     }
-    return;
 }
 
-// 解析URI并将解析结果存储到filename和cgiargs指向的字符串中
-// 参数uri是待解析的URI字符串
-// 参数filename是存储解析出来的文件路径的字符串指针
-// 参数cgiargs是存储解析出来的CGI参数的字符串指针
-// 返回值为一个整型数，表示是否解析出了CGI程序
-int parse_uri(const char *uri, char *filename, char *cgiargs)
+/*
+ * 读入文件，连同预先构造好的响应头部一起放入缓存，无法缓存时返回NULL。
+ * 可压缩的文件同时生成各压缩版本，之后的请求直接从缓存中选用。etag为空串时
+ * 由读入的内容计算本版本的ETag并写回。
+ */
+static cache_entry_t *cache_fill(const char *filename, const struct stat *sbuf, char *etag)
 {
-    char *ptr;
+    char filetype[MAXLINE], *body, *zbody;
+    cache_variant_t var[ENC_COUNT];
+    ssize_t zlen;
+    int srcfd, enc;
+    cache_entry_t *e;
 
-    if (!strstr(uri, "calculate/add?")) // 如果URI中不包含"?"子串，说明是静态内容
+    if (!cache_admits(sbuf->st_size))
+        return NULL;
+    if ((srcfd = open(filename, O_RDONLY, 0)) < 0)
+        return NULL;
+    body = Malloc(sbuf->st_size + 1);
+    if (rio_readn(srcfd, body, sbuf->st_size) != sbuf->st_size) // 读取期间文件被截断
     {
-        /* 静态内容 */
-        strcpy(cgiargs, "");   // 清空CGI参数
-        strcpy(filename, "."); // 将"."作为文件路径的起始点
-        strcat(filename, uri); // 将URI拼接到文件路径后面
-
-        if (uri[strlen(uri) - 1] == '/')    // 如果URI以"/"结尾
-            strcat(filename, "index.html"); // 在文件路径后面拼接上默认的文件名"index.html",即主页
-        return 1;                           // 返回1，表示解析出的是静态内容
+        close(srcfd);
+        free(body);
+        return NULL;
     }
-    else
-    {
-        /* 动态内容 */
-        ptr = index(uri, '?'); // 在URI中定位"?"字符的位置
+    close(srcfd);
 
-        if (ptr) // 如果“？”存在
+    get_filetype(filename, filetype); // 获取文件类型
+    if (etag[0] == '\0') // 内容已在内存中，顺便计算本版本的ETag
+        etag_compute(body, sbuf->st_size, etag);
+    cache_variant(&var[ENC_IDENTITY], filename, filetype, ENC_IDENTITY, body, sbuf->st_size, etag, sbuf->st_mtime);
+    for (enc = ENC_IDENTITY + 1; enc < ENC_COUNT; enc++)
+    {
+        zlen = -1;
+        if (encoding_compressible(filetype))
+            zlen = encoding_compress(enc, body, sbuf->st_size, &zbody);
+        cache_variant(&var[enc], filename, filetype, enc, zlen < 0 ? NULL : zbody, zlen, etag, sbuf->st_mtime);
+    }
+    if ((e = cache_insert(filename, sbuf, var, etag)) == NULL)
+        for (enc = 0; enc < ENC_COUNT; enc++)
         {
-            strcpy(cgiargs, ptr + 1); // 把"?"后面的部分作为CGI参数保存下来
-            *ptr = '\0';              // 将"?"替换为NULL，截断URI字符串
+            free(var[enc].hdr);
+            free(var[enc].body);
         }
-        else
-            strcpy(cgiargs, ""); // 清空CGI参数
-        strcpy(filename, ".");   // 将"."作为文件路径的起始点
-        strcat(filename, uri);   // 将URI拼接到文件路径后面
-        return 0;                // 返回0，表示解析出的是动态内容
+    return e;
+}
+
+/*
+ * 选用客户端可接受的最优编码。e为NULL（文件尚未缓存）时按缓存后会生成的版本推测，
+ * 只用于304响应中的ETag。
+ */
+static int pick_encoding(request_t *rq, const cache_entry_t *e, const char *filename, int cacheable)
+{
+    char filetype[MAXLINE];
+    int enc;
+
+    if (e == NULL)
+    {
+        get_filetype(filename, filetype);
+        if (!cacheable || !encoding_compressible(filetype))
+            return ENC_IDENTITY;
+    }
+    for (enc = ENC_COUNT - 1; enc > ENC_IDENTITY; enc--)
+        if ((rq->accept_enc & (1 << enc)) && (e == NULL || e->var[enc].body))
+            break;
+    return enc;
+}
+
+/*
+ * 读入尚未缓存的小文件计算内容ETag，与缓存后使用的ETag相同，只在条件请求需要比较ETag时
+ * 使用；文件大小不超过缓存的上限，不做压缩。失败返回-1。
+ */
+static int file_etag(const char *filename, const struct stat *sbuf, char *etag)
+{
+    char *buf;
+    int fd, rc = -1;
+
+    if ((fd = open(filename, O_RDONLY, 0)) < 0)
+        return -1;
+    buf = Malloc(sbuf->st_size + 1);
+    if (rio_readn(fd, buf, sbuf->st_size) == sbuf->st_size) // 读取期间文件被截断时放弃
+    {
+        etag_compute(buf, sbuf->st_size, etag);
+        rc = 0;
     }
+    close(fd);
+    free(buf);
+    return rc;
 }
 
-void serve_static(int fd, const char *filename, int filesize)
+void serve_static(request_t *rq, const char *filename, const struct stat *sbuf)
 {
-    int srcfd; // 存储打开文件的文件描述符
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    int srcfd;                      // 存储打开文件的文件描述符
+    off_t filesize = sbuf->st_size; // 文件大小
+    char filetype[MAXLINE];         // 文件类型
+    char etag[ETAG_LEN];            // 文件当前版本的ETag
+    char hdr[MAXLINE];              // 验证与缓存头部
+    cache_entry_t *e;               // 缓存条目
+    cache_variant_t *v;             // 选用的编码版本
+    range_t ranges[RANGE_MAX];      // 请求的字节范围
+    response_t resp;                // 响应构造器
+    int cacheable = filesize < config.sendfile_min && cache_admits(filesize); // 小文件走缓存
+    int n;
 
-    /* 发送响应报头给客户端 */
-    get_filetype(filename, filetype);                                 // 获取文件类型，存储到filetype数组中
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");                              // 构造响应报头：状态行
-    Rio_writen(fd, buf, strlen(buf));                                 // 将响应报头写入套接字缓冲区
-    sprintf(buf, "Server: Book Web Server\r\n");                      // 构造响应报头：服务器信息
-    Rio_writen(fd, buf, strlen(buf));                                 // 将响应报头写入套接字缓冲区
-    sprintf(buf, "Content-length: %d\r\n", filesize);                 // 构造响应报头：文件长度
-    Rio_writen(fd, buf, strlen(buf));                                 // 将响应报头写入套接字缓冲区
-    snprintf(buf, sizeof(buf), "Content-type: %s\r\n\r\n", filetype); // 构造响应报头：文件类型
-    Rio_writen(fd, buf, strlen(buf));                                 // 将响应报头写入套接字缓冲区
+    /*
+     * 先判断条件请求，再发送文件。可缓存的文件使用内容ETag：已缓存的从条目中取；未缓存的
+     * 只在请求需要比较ETag时才读文件计算，否则由cache_fill顺便计算。其余文件不读取内容，
+     * 使用由文件版本得出的ETag。
+     */
+    e = cacheable ? cache_lookup(filename, sbuf) : NULL;
+    etag[0] = '\0';
+    if (e != NULL)
+        memcpy(etag, e->etag, ETAG_LEN);
+    else if (!cacheable)
+        etag_identity(sbuf, etag);
+    else if ((http_header(rq->hdrs, HDR_IF_NONE_MATCH) || http_header(rq->hdrs, HDR_IF_RANGE)) &&
+             file_etag(filename, sbuf, etag) < 0)
+        etag[0] = '\0';
+    if (not_modified(rq, etag, sbuf->st_mtime))
+    {
+        send_not_modified(rq, filename, etag, pick_encoding(rq, e, filename, cacheable), sbuf->st_mtime);
+        if (e != NULL)
+            cache_release(e);
+        return;
+    }
+
+    /* 小文件走缓存：头部与文件内容都在内存中，一次sendmsg发出 */
+    if (e == NULL && cacheable)
+        e = cache_fill(filename, sbuf, etag);
+    if (e != NULL)
+    {
+        v = &e->var[pick_encoding(rq, e, filename, cacheable)];
+        if ((n = range_request(rq, etag, sbuf, ranges)) >= 0) // 范围总是针对未编码的原始内容
+        {
+            if (n == 0)
+                send_unsatisfiable(rq, filename, sbuf, etag);
+            else
+                send_ranges(rq, filename, sbuf, etag, e->var[ENC_IDENTITY].body, -1, ranges, n);
+            cache_release(e);
+            return;
+        }
+        resp_init_raw(&resp, rq, 200, v->hdr, v->hdrlen);
+        if (rq->sethdr[0])
+            resp_header(&resp, "%s", rq->sethdr);
+        resp_body(&resp, v->body, v->bodylen);
+        resp_send(&resp);
+        cache_release(e);
+        return;
+    }
 
-    /* 发送响应正文给客户端 */
-    srcfd = Open(filename, O_RDONLY, 0);                        // 以只读方式打开请求的文件，返回文件描述符
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0); // 将文件映射到进程的地址空间中
-    Close(srcfd);                                               // 关闭文件描述符
-    Rio_writen(fd, srcp, filesize);                             // 发送文件数据到客户端
-    Munmap(srcp, filesize);                                     // 取消文件映射
+    /* 大文件或无法缓存的文件：由内核直接从页缓存发送正文，不经过用户空间 */
+    if (etag[0] == '\0') // 未能由内容计算时（如读取失败）同样使用版本ETag
+        etag_identity(sbuf, etag);
+    if ((n = range_request(rq, etag, sbuf, ranges)) == 0)
+    {
+        send_unsatisfiable(rq, filename, sbuf, etag);
+        return;
+    }
+    if ((srcfd = open(filename, O_RDONLY, 0)) < 0) // 以只读方式打开请求的文件，返回文件描述符
+    {
+        clienterror(rq, filename, "404", "Not found", "Book couldn't find this file");
+        return;
+    }
+    if (n > 0) // 各范围与完整响应一样经由sendfile发送
+    {
+        send_ranges(rq, filename, sbuf, etag, NULL, srcfd, ranges, n);
+        close(srcfd);
+        return;
+    }
+    get_filetype(filename, filetype);
+    resp_init(&resp, rq, 200, "OK");
+    resp_header(&resp, "Content-type: %s", filetype);
+    if (encoding_compressible(filetype)) // 与缓存路径的头部保持一致
+        resp_header(&resp, "Vary: Accept-Encoding");
+    resp_header(&resp, "Accept-Ranges: bytes");
+    resp_header(&resp, "%.*s", validator_header(hdr, sizeof(hdr), filename, etag, ENC_IDENTITY, sbuf->st_mtime) - 2, hdr);
+    if (rq->sethdr[0])
+        resp_header(&resp, "%s", rq->sethdr);
+    resp_file(&resp, srcfd, 0, filesize);
+    resp_send(&resp);
+    close(srcfd); // 关闭文件描述符
 }
 
 /* 获取请求文件类型 */
@@ -357,32 +986,120 @@ void get_filetype(const char *filename, char *filetype)
         strcpy(filetype, "text/plain");
 }
 
-void serve_dynamic(int fd, const char *filename, const char *cgiargs)
+/*
+ * cgi_headers - 解析CGI程序输出的头部并据此开始构造响应：输出由头部、空行与正文
+ *    组成，状态码取自"Status:"头部或程序自行输出的HTTP状态行，缺省为200。其余头部
+ *    原样转发，Content-length、Transfer-Encoding与Connection由响应构造器决定，
+ *    因此连接可以继续复用。out会被原地修改，返回正文的起始位置。
+ */
+char *cgi_headers(response_t *resp, request_t *rq, char *out, size_t outlen)
+{
+    char *p = out, *end = out + outlen, *eol, *line;
+    char *hdrs[CGI_MAXHDRS]; // 待转发的头部行
+    const char *reason = "OK";
+    int status = 200, nhdr = 0, i;
+
+    for (; p < end && (eol = memchr(p, '\n', end - p)) != NULL; p = eol + 1)
+    {
+        line = p;
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r')
+            eol[-1] = '\0';
+        if (*line == '\0') // 空行，头部结束
+        {
+            p = eol + 1;
+            break;
+        }
+        if (!strncmp(line, "HTTP/", 5) || !strncasecmp(line, "Status:", 7))
+        {
+            line = strchr(line, line[0] == 'H' ? ' ' : ':');
+            status = line ? atoi(line + 1) : 500;
+            if (line && (line = strchr(line + strspn(line, ": "), ' ')) != NULL)
+                reason = line + 1;
+        }
+        else if (!strncasecmp(line, "Content-length:", 15) || !strncasecmp(line, "Transfer-Encoding:", 18) ||
+                 !strncasecmp(line, "Connection:", 11))
+            continue; // 由服务器决定响应的分界方式
+        else if (nhdr < CGI_MAXHDRS)
+            hdrs[nhdr++] = line;
+    }
+    if (status < 100 || status > 999)
+        status = 500;
+
+    resp_init(resp, rq, status, reason);
+    for (i = 0; i < nhdr; i++)
+        resp_header(resp, "%s", hdrs[i]);
+    return p;
+}
+
+void serve_dynamic(request_t *rq, const char *filename, const char *cgiargs)
 {
-    char buf[MAXLINE], *emptylist[] = {NULL};
+    char *emptylist[] = {NULL};
+    char *out, *body;                         // CGI程序的全部输出与其中的正文
+    response_t resp;                          // 响应构造器
+    size_t outlen = 0, outsize = MAXBUF;
+    ssize_t n;
+    char extra;                               // 输出达到上限后试读的一个字节
+    int overflow = 0;                         // 输出超过CGI_MAXOUT
+    int pfd[2];                               // 读取CGI输出的管道
+    pid_t pid;
 
-    if (Fork() == 0) // 如果fork()的返回值为0，说明当前处于子进程中
+    if (pipe(pfd) < 0)
+    {
+        clienterror(rq, filename, "500", "Internal Server Error", "Book couldn't run the CGI program");
+        return;
+    }
+    metrics_add(M_CGI_FORKS, 1);
+    if ((pid = Fork()) == 0) // 如果fork()的返回值为0，说明当前处于子进程中
     {
         /* 子进程 */
         /* 在真实的服务器中，需要在此处设置所有 CGI 环境变量 */
         setenv("QUERY_STRING", cgiargs, 1);   // 调用setenv()函数来设置QUERY_STRING环境变量，以便将查询字符串传递给CGI程序。
-        Dup2(fd, STDOUT_FILENO);              // 将标准输出重定向到客户端套接字描述符
+        close(pfd[0]);
+        Dup2(pfd[1], STDOUT_FILENO);          // 将标准输出重定向到管道，由服务器补全响应头部后再发给客户端
         Execve(filename, emptylist, environ); // 运行CGI程序
     }
-    Wait(NULL); // 父进程等待子进程结束并回收其资源
+    close(pfd[1]);
+
+    out = Malloc(outsize);
+    while ((n = rio_readn(pfd[0], out + outlen, outsize - outlen)) > 0) // 读到CGI程序关闭标准输出为止
+    {
+        outlen += n;
+        if (outlen < outsize)
+            continue;
+        if (outsize >= CGI_MAXOUT) // 已达上限，还有数据说明输出过大
+        {
+            overflow = rio_readn(pfd[0], &extra, 1) > 0;
+            break;
+        }
+        out = Realloc(out, outsize *= 2);
+    }
+    if (overflow) // 子进程可能阻塞在写满的管道上，先终止它再回收
+        kill(pid, SIGKILL);
+    close(pfd[0]);
+    Waitpid(pid, NULL, 0); // 父进程只回收自己的子进程，避免与其他工作线程互相抢夺
+
+    if (overflow) // 不能把截断的输出当作完整的响应发出
+    {
+        free(out);
+        rq->keepalive = 0;
+        clienterror(rq, filename, "500", "Internal Server Error", "The CGI program's output is too large");
+        return;
+    }
+    body = cgi_headers(&resp, rq, out, outlen);
+    resp_body(&resp, body, out + outlen - body);
+    resp_send(&resp);
+    free(out);
 }
 
-void clienterror(int fd, const char *cause, const char *errnum, const char *shortmsg, const char *longmsg)
+void clienterror(request_t *rq, const char *cause, const char *errnum, const char *shortmsg, const char *longmsg)
 {
-    char buf[MAXLINE];
-    /* 发送响应报头给客户端 */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    char body[MAXBUF];
+    int bodylen;
+    response_t resp;
 
-    /* 发送错误响应给客户端 */
-    sprintf(buf, "<!DOCTYPE html>\n"
+    /* 构造错误响应正文，先得到其长度以便填写Content-length */
+    bodylen = snprintf(body, sizeof(body), "<!DOCTYPE html>\n"
                  "<html>\n"
                  "<head>\n"
                  "<title>Eerror</title>\n"
@@ -398,9 +1115,9 @@ void clienterror(int fd, const char *cause, const char *errnum, const char *shor
                  "  animation: gradient 15s ease infinite;\n"
                  "}\n"
                  "@keyframes gradient {\n"
-                 "  0% { background-position: 0% 50%; }\n"
-                 "  50% { background-position: 100% 50%; }\n"
-                 "  100% { background-position: 0% 50%; }\n"
+                 "  0%% { background-position: 0%% 50%%; }\n"
+                 "  50%% { background-position: 100%% 50%%; }\n"
+                 "  100%% { background-position: 0%% 50%%; }\n"
                  "}\n"
                  "h1 {\n"
                  "  font-family: \"宋体\", STSongti, serif;\n"
@@ -451,7 +1168,7 @@ void clienterror(int fd, const char *cause, const char *errnum, const char *shor
                  "</script>\n"
                  "</head>\n"
                  "<body>\n"
-                 "<div class=\"center\" id=\"register-form\" style=\"height:50%;width:35%;\">\n"
+                 "<div class=\"center\" id=\"register-form\" style=\"height:50%%;width:35%%;\">\n"
                  "<form>\n"
                  "<h1 class=\"error\">%s: %s</h1>\n"
                  "<p class=\" center \">%s: %s</p>\n"
@@ -463,5 +1180,25 @@ void clienterror(int fd, const char *cause, const char *errnum, const char *shor
                  "</body>\n"
                  "</html>\n",
             errnum, shortmsg, longmsg, cause);
-    Rio_writen(fd, buf, strlen(buf));
-}
\ No newline at end of file
+    if (bodylen >= (int)sizeof(body)) // 原因字符串过长时正文被截断
+        bodylen = sizeof(body) - 1;
+
+    /* 发送错误响应给客户端 */
+    resp_init(&resp, rq, atoi(errnum), shortmsg);
+    resp_header(&resp, "Content-type: text/html");
+    if (rq->sethdr[0]) // 如405的Allow、登录后的Set-Cookie
+        resp_header(&resp, "%s", rq->sethdr);
+    resp_body(&resp, body, bodylen);
+    resp_send(&resp);
+}
+
+void redirect(request_t *rq, const char *location)
+{
+    response_t resp;
+
+    resp_init(&resp, rq, 302, "Found");
+    resp_header(&resp, "Location: %s", location);
+    if (rq->sethdr[0])
+        resp_header(&resp, "%s", rq->sethdr);
+    resp_send(&resp);
+}
@@ -0,0 +1,457 @@
+#include "csapp.h"
+
+/*
+ * 压力测试工具：每个线程维护一个到服务器的连接，按场景重复发送请求并记录延迟。
+ * 闭环模式（默认）下收到响应后立即发送下一个请求，测量服务器在给定并发数下的
+ * 吞吐量；开环模式（-r）按固定速率发送，延迟从计划发送的时刻算起，服务器变慢时
+ * 请求排队的时间也计入，不会因客户端停下来等待而低估尾延迟。
+ * 结果以JSON输出；-b给出基线文件时与之比较，吞吐量或p99退化超过容差时返回1。
+ */
+
+#define HIST_SUB 16      // 每个2的幂区间的桶数，相对误差约6%
+#define HIST_SUB_BITS 4  // log2(HIST_SUB)
+#define HIST_OCTAVES 40  // 量程约2^40微秒
+#define HIST_BUCKETS (HIST_SUB * HIST_OCTAVES)
+#define BENCH_MAXMIX 8   // -s最多组合的场景数
+#define DEF_CONCURRENCY 16
+#define DEF_DURATION 10  // 默认测试时长（秒）
+#define DEF_TOLERANCE 10 // 默认与基线比较的容差（%）
+
+/* 测试场景，body中的%s依次为用户名与密码 */
+typedef struct
+{
+    const char *name;
+    const char *method;
+    const char *path;
+    const char *body;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"static", "GET", "/index.html", NULL},
+    {"jpeg", "GET", "/Picture/page.jpg", NULL},
+    {"add", "GET", "/calculate/add?3&4", NULL},
+    {"login", "POST", "/home.html", "username=%s&password=%s"},
+    {"register", "POST", "/user.html", "username=%s&password=%s&emailname=bench&email_suffix=%%40bench.com"},
+    {NULL, NULL, NULL, NULL}};
+
+/* 一个测试线程的参数与统计 */
+typedef struct
+{
+    int id;
+    pthread_t tid;
+    double interval;                  // 开环模式下相邻请求的计划间隔（秒），0表示闭环
+    unsigned long hist[HIST_BUCKETS]; // 延迟直方图（微秒）
+    unsigned long requests, errors;
+    unsigned long status[6];          // 按状态码的百位计数
+    unsigned long bytes;              // 响应正文字节数
+    unsigned long max_us;
+    double sum_us;
+    unsigned long seq;                // 已构造的请求数，用于生成不重复的注册用户名
+} worker_t;
+
+static const char *host, *port;
+static int nworkers;                        // 并发连接数
+static const scenario_t *mix[BENCH_MAXMIX]; // 依次轮流使用的场景
+static int nmix;
+static int keepalive;
+static const char *user = "bench", *pass = "bench";
+static double t_start, t_measure, t_end; // 开始、预热结束与结束的时刻
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int hist_index(unsigned long v)
+{
+    int e;
+
+    if (v < HIST_SUB)
+        return (int)v;
+    e = 63 - __builtin_clzl(v);
+    if (e - HIST_SUB_BITS + 1 >= HIST_OCTAVES)
+        return HIST_BUCKETS - 1;
+    return HIST_SUB * (e - HIST_SUB_BITS + 1) + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static unsigned long hist_upper(int i)
+{
+    int e = i / HIST_SUB + HIST_SUB_BITS - 1, sub = i % HIST_SUB;
+
+    if (i < HIST_SUB)
+        return i;
+    return ((unsigned long)(HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+/* 直方图中第q分位的延迟（微秒），取所在桶的上界 */
+static unsigned long percentile(const unsigned long *hist, unsigned long total, double q)
+{
+    unsigned long rank = (unsigned long)(q * total + 0.5), seen = 0;
+    int i;
+
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        if ((seen += hist[i]) >= rank)
+            return hist_upper(i);
+    return hist_upper(HIST_BUCKETS - 1);
+}
+
+/* 读取并丢弃n字节，返回-1表示连接中断 */
+static int discard(rio_t *rp, size_t n)
+{
+    char buf[MAXBUF];
+    size_t k;
+
+    while (n > 0)
+    {
+        k = n < sizeof(buf) ? n : sizeof(buf);
+        if (rio_readnb(rp, buf, k) != (ssize_t)k)
+            return -1;
+        n -= k;
+    }
+    return 0;
+}
+
+/*
+ * 读取一个响应，状态码存入*status，正文长度累加到*bytes；服务器表示要关闭连接
+ *    或正文以连接关闭为结束时置*closing。格式错误或连接中断返回-1。
+ */
+static int read_response(rio_t *rp, int *status, unsigned long *bytes, int *closing)
+{
+    char line[MAXLINE];
+    long len = -1, size;
+    int chunked = 0;
+    ssize_t n;
+
+    if (rio_readlineb(rp, line, MAXLINE) <= 0 || sscanf(line, "HTTP/1.%*d %d", status) != 1)
+        return -1;
+    while ((n = rio_readlineb(rp, line, MAXLINE)) > 0 && strcmp(line, "\r\n"))
+    {
+        if (!strncasecmp(line, "Content-length:", 15))
+            len = atol(line + 15);
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strstr(line, "chunked"))
+            chunked = 1;
+        else if (!strncasecmp(line, "Connection:", 11) && strstr(line, "close"))
+            *closing = 1;
+    }
+    if (n <= 0)
+        return -1;
+
+    if (chunked)
+    {
+        for (;;)
+        {
+            if (rio_readlineb(rp, line, MAXLINE) <= 0)
+                return -1;
+            if ((size = strtol(line, NULL, 16)) == 0)
+                break;
+            if (discard(rp, size + 2) < 0) // 块数据及其后的CRLF
+                return -1;
+            *bytes += size;
+        }
+        do // 尾部头部
+        {
+            if (rio_readlineb(rp, line, MAXLINE) <= 0)
+                return -1;
+        } while (strcmp(line, "\r\n"));
+    }
+    else if (len >= 0)
+    {
+        if (discard(rp, len) < 0)
+            return -1;
+        *bytes += len;
+    }
+    else // 没有长度的正文以关闭连接结束
+    {
+        while ((n = rio_readnb(rp, line, sizeof(line))) > 0)
+            *bytes += n;
+        *closing = 1;
+    }
+    return 0;
+}
+
+/* 按场景构造一个请求，返回其长度 */
+static int build_request(char *buf, size_t size, const scenario_t *sc, worker_t *w)
+{
+    char body[MAXLINE], name[MAXLINE];
+    int bodylen;
+
+    if (sc->body == NULL)
+        return snprintf(buf, size, "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                        sc->method, sc->path, host, keepalive ? "keep-alive" : "close");
+    if (!strcmp(sc->name, "register")) // 每次注册一个新用户
+        snprintf(name, sizeof(name), "%s_%d_%d_%lu", user, (int)getpid(), w->id, w->seq);
+    else
+        snprintf(name, sizeof(name), "%s", user);
+    w->seq++;
+    bodylen = snprintf(body, sizeof(body), sc->body, name, pass);
+    return snprintf(buf, size, "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n"
+                               "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n%s",
+                    sc->method, sc->path, host, keepalive ? "keep-alive" : "close", bodylen, body);
+}
+
+static void record(worker_t *w, double sent, int status)
+{
+    unsigned long us = (unsigned long)((now() - sent) * 1e6);
+
+    if (sent < t_measure) // 预热期间的请求不计入
+        return;
+    w->requests++;
+    w->hist[hist_index(us)]++;
+    w->sum_us += us;
+    if (us > w->max_us)
+        w->max_us = us;
+    if (status >= 100 && status < 600)
+        w->status[status / 100]++;
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    char req[2 * MAXLINE];
+    rio_t rio;
+    int fd = -1, status, closing, len, k = w->id;
+    unsigned long bytes;
+    double next = t_start + w->interval * w->id / nworkers, sent, t; // 各线程的发送时刻错开
+
+    while ((t = now()) < t_end)
+    {
+        if (w->interval > 0) // 开环：到计划时刻才发送，落后时立即发送，延迟仍从计划时刻算起
+        {
+            if (t < next)
+            {
+                struct timespec ts = {(time_t)(next - t), (long)((next - t - (time_t)(next - t)) * 1e9)};
+                nanosleep(&ts, NULL);
+            }
+            sent = next;
+            next += w->interval;
+        }
+        else
+            sent = t;
+
+        if (fd < 0)
+        {
+            if ((fd = open_clientfd(host, port)) < 0)
+            {
+                if (sent >= t_measure)
+                    w->errors++;
+                continue;
+            }
+            rio_readinitb(&rio, fd);
+        }
+        len = build_request(req, sizeof(req), mix[k++ % nmix], w);
+        closing = !keepalive;
+        bytes = 0;
+        if (rio_writen(fd, req, len) != len || read_response(&rio, &status, &bytes, &closing) < 0)
+        {
+            if (sent >= t_measure)
+                w->errors++;
+            closing = 1;
+        }
+        else
+        {
+            record(w, sent, status);
+            if (sent >= t_measure)
+                w->bytes += bytes;
+        }
+        if (closing)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+/* 在JSON文本中找到"key":之后的数值，没有时返回-1 */
+static double json_number(const char *json, const char *key)
+{
+    char pat[64];
+    const char *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    if ((p = strstr(json, pat)) == NULL)
+        return -1;
+    return atof(p + strlen(pat));
+}
+
+/* 与基线比较，有退化时返回1 */
+static int compare_baseline(const char *path, double rps, double p99, int tolerance)
+{
+    char json[MAXBUF];
+    double base_rps, base_p99;
+    size_t n;
+    FILE *fp;
+    int bad = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "bench: cannot open baseline %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    n = fread(json, 1, sizeof(json) - 1, fp);
+    json[n] = '\0';
+    fclose(fp);
+    base_rps = json_number(json, "throughput_rps");
+    base_p99 = json_number(json, "p99");
+    if (base_rps <= 0 || base_p99 < 0)
+    {
+        fprintf(stderr, "bench: baseline %s has no throughput_rps/p99\n", path);
+        return 1;
+    }
+    fprintf(stderr, "throughput: %.1f rps (baseline %.1f, %+.1f%%)\n", rps, base_rps, (rps / base_rps - 1) * 100);
+    fprintf(stderr, "p99: %.0f us (baseline %.0f, %+.1f%%)\n", p99, base_p99, base_p99 > 0 ? (p99 / base_p99 - 1) * 100 : 0);
+    if (rps < base_rps * (100 - tolerance) / 100)
+    {
+        fprintf(stderr, "REGRESSION: throughput dropped more than %d%%\n", tolerance);
+        bad = 1;
+    }
+    if (p99 > base_p99 * (100 + tolerance) / 100)
+    {
+        fprintf(stderr, "REGRESSION: p99 latency grew more than %d%%\n", tolerance);
+        bad = 1;
+    }
+    return bad;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s <host> <port> [-s scenario[,scenario...]] [-c concurrency] [-d seconds] [-w warmup_seconds] "
+                    "[-r rate] [-k] [-u user] [-P password] [-o out.json] [-b baseline.json] [-T tolerance_pct]\n"
+                    "scenarios: static jpeg add login register\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int concurrency = DEF_CONCURRENCY, tolerance = DEF_TOLERANCE, duration = DEF_DURATION, warmup = 0;
+    const char *spec = "static", *out = NULL, *baseline = NULL;
+    double rate = 0, elapsed, rps, p99;
+    unsigned long hist[HIST_BUCKETS] = {0}, requests = 0, errors = 0, status[6] = {0}, bytes = 0, max_us = 0;
+    double sum_us = 0;
+    char names[MAXLINE], *tok, *save;
+    worker_t *w;
+    FILE *fp = stdout;
+    int opt, i, j;
+
+    if (argc < 3 || argv[1][0] == '-')
+        usage(argv[0]);
+    host = argv[1];
+    port = argv[2];
+    optind = 3;
+    while ((opt = getopt(argc, argv, "s:c:d:w:r:ku:P:o:b:T:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            spec = optarg;
+            break;
+        case 'c':
+            concurrency = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'r': // 总请求速率（每秒），指定后为开环模式
+            rate = atof(optarg);
+            break;
+        case 'k':
+            keepalive = 1;
+            break;
+        case 'u':
+            user = optarg;
+            break;
+        case 'P':
+            pass = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'T':
+            tolerance = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    snprintf(names, sizeof(names), "%s", spec);
+    for (tok = strtok_r(names, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; scenarios[i].name && strcmp(scenarios[i].name, tok); i++)
+            ;
+        if (scenarios[i].name == NULL || nmix == BENCH_MAXMIX)
+            usage(argv[0]);
+        mix[nmix++] = &scenarios[i];
+    }
+    if (nmix == 0 || concurrency <= 0 || duration <= 0 || warmup < 0 || rate < 0)
+        usage(argv[0]);
+    signal(SIGPIPE, SIG_IGN);
+
+    nworkers = concurrency;
+    w = Calloc(concurrency, sizeof(worker_t));
+    t_start = now();
+    t_measure = t_start + warmup;
+    t_end = t_measure + duration;
+    for (i = 0; i < concurrency; i++)
+    {
+        w[i].id = i;
+        w[i].interval = rate > 0 ? concurrency / rate : 0;
+        Pthread_create(&w[i].tid, NULL, worker, &w[i]);
+    }
+    for (i = 0; i < concurrency; i++)
+    {
+        Pthread_join(w[i].tid, NULL);
+        for (j = 0; j < HIST_BUCKETS; j++)
+            hist[j] += w[i].hist[j];
+        for (j = 0; j < 6; j++)
+            status[j] += w[i].status[j];
+        requests += w[i].requests;
+        errors += w[i].errors;
+        bytes += w[i].bytes;
+        sum_us += w[i].sum_us;
+        if (w[i].max_us > max_us)
+            max_us = w[i].max_us;
+    }
+    elapsed = now() - t_measure;
+    rps = requests / elapsed;
+    p99 = requests ? percentile(hist, requests, 0.99) : 0;
+
+    if (out && (fp = fopen(out, "w")) == NULL)
+        unix_error("bench: cannot open output");
+    fprintf(fp, "{\n"
+                "  \"scenario\": \"%s\",\n"
+                "  \"mode\": \"%s\",\n"
+                "  \"concurrency\": %d,\n"
+                "  \"rate\": %.1f,\n"
+                "  \"keepalive\": %s,\n"
+                "  \"duration_s\": %.3f,\n"
+                "  \"requests\": %lu,\n"
+                "  \"errors\": %lu,\n"
+                "  \"status\": {\"2xx\": %lu, \"3xx\": %lu, \"4xx\": %lu, \"5xx\": %lu},\n"
+                "  \"bytes\": %lu,\n"
+                "  \"throughput_rps\": %.1f,\n",
+            spec, rate > 0 ? "open" : "closed", concurrency, rate, keepalive ? "true" : "false", elapsed,
+            requests, errors, status[2], status[3], status[4], status[5], bytes, rps);
+    fprintf(fp, "  \"latency_us\": {\"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %.0f, \"p999\": %lu, \"max\": %lu}\n"
+                "}\n",
+            requests ? sum_us / requests : 0, requests ? percentile(hist, requests, 0.50) : 0,
+            requests ? percentile(hist, requests, 0.90) : 0, p99,
+            requests ? percentile(hist, requests, 0.999) : 0, max_us);
+    if (fp != stdout)
+        fclose(fp);
+    free(w);
+    return baseline ? compare_baseline(baseline, rps, p99, tolerance) : 0;
+}
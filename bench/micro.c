@@ -0,0 +1,330 @@
+#include "sever.h"
+
+/*
+ * 微基准测试：单独测量Rio缓冲读取与请求解析等基础函数的开销，输出每次操作的
+ * 纳秒数与字节数，用来证明对这些函数的优化确实有效，并防止性能倒退。
+ * 与服务器的其余部分链接在一起，只替换掉book_sever.c中的main与连接管理。
+ * 每项测试自动增加迭代次数，直到运行时间不少于-t指定的秒数。
+ */
+
+#define DEF_BENCHTIME 0.5 // 每项测试的最短运行时间（秒）
+
+/* attached_sever.c中未在头文件声明的函数 */
+int parse_uri(const char *uri, char *filename, char *cgiargs);
+void get_filetype(const char *filename, char *filetype);
+
+/* 代替book_sever.c */
+config_t config = {15, 100, 0, 128 << 10, 1800, 0, 2, 1024 << 10, LOG_OFF, 1, 0, NULL, 0, 0};
+
+void conn_close(conn_t *c)
+{
+    close(c->fd);
+}
+
+void conn_idle(conn_t *c)
+{
+}
+
+/* 具有代表性的请求头部 */
+static const char *requests[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: sid=0123456789abcdef0123456789abcdef\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n",
+    "GET /Picture/page.jpg HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+    "POST /home.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 31\r\n"
+    "Origin: http://127.0.0.1:8080\r\n"
+    "Referer: http://127.0.0.1:8080/index.html\r\n"
+    "\r\n",
+    NULL};
+
+static const char *uris[] = {"/index.html", "/", "/Picture/page.jpg", "/calculate/add?12&30",
+                             "/%E4%B9%A6/%E7%BA%A2%E6%A5%BC%E6%A2%A6.html", "/a/b/c/d/e/f/g/index.html?x=1&y=2", NULL};
+
+static const char *filenames[] = {"./index.html", "./Picture/page.jpg", "./Picture/book.ico", "./README.md",
+                                  "./Picture/cPrimerPlus.jpg", "./register_success.html", NULL};
+
+static const char *form = "username=%E5%BC%A0%E4%B8%89&password=p%40ss+word&emailname=zhang.san&email_suffix=%40qq.com";
+
+static char corpus[RIO_BUFSIZE]; // 由请求头部重复拼成的输入
+static size_t corpus_len;
+static int corpus_lines;
+
+/* 一项测试：执行n次操作 */
+typedef struct
+{
+    const char *name;
+    void (*fn)(long n);
+    size_t bytes; // 每次操作处理的字节数，0表示不统计
+} bench_t;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 防止编译器把结果未被使用的计算优化掉 */
+static volatile size_t sink;
+
+/* rio_readlineb：输入预先放在缓冲区中，不经过系统调用，每次操作读一行 */
+static void bench_readline_mem(long n)
+{
+    static rio_t rio;
+    char line[MAXLINE];
+    long i;
+
+    rio_readinitb(&rio, -1);
+    for (i = 0; i < n; i++)
+    {
+        if (rio.rio_cnt == 0)
+        {
+            memcpy(rio.rio_buf, corpus, corpus_len);
+            rio.rio_bufptr = rio.rio_buf;
+            rio.rio_cnt = corpus_len;
+        }
+        sink += rio_readlineb(&rio, line, MAXLINE);
+    }
+}
+
+/* 不断把corpus写入描述符，直到对端关闭 */
+static void *feeder(void *arg)
+{
+    int fd = (int)(long)arg;
+
+    while (rio_writen(fd, corpus, corpus_len) == (ssize_t)corpus_len)
+        ;
+    close(fd);
+    return NULL;
+}
+
+/* 建立管道或socketpair并启动写入线程，返回读端 */
+static int start_feeder(int socket, pthread_t *tid)
+{
+    int fds[2];
+
+    if (socket ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 : pipe(fds) < 0)
+        unix_error("micro: pipe error");
+    Pthread_create(tid, NULL, feeder, (void *)(long)fds[1]);
+    return fds[0];
+}
+
+static void stop_feeder(int fd, pthread_t tid)
+{
+    close(fd); // 写入线程随即因EPIPE退出
+    Pthread_join(tid, NULL);
+}
+
+/* rio_readlineb：经由管道读取，包含填充缓冲区的read */
+static void bench_readline_pipe(long n)
+{
+    rio_t rio;
+    char line[MAXLINE];
+    pthread_t tid;
+    int fd = start_feeder(0, &tid);
+    long i;
+
+    rio_readinitb(&rio, fd);
+    for (i = 0; i < n; i++)
+        sink += rio_readlineb(&rio, line, MAXLINE);
+    stop_feeder(fd, tid);
+}
+
+/* rio_readnb：经由socketpair每次读取4KB */
+static void bench_readnb_socket(long n)
+{
+    rio_t rio;
+    char buf[4096];
+    pthread_t tid;
+    int fd = start_feeder(1, &tid);
+    long i;
+
+    rio_readinitb(&rio, fd);
+    for (i = 0; i < n; i++)
+        sink += rio_readnb(&rio, buf, sizeof(buf));
+    stop_feeder(fd, tid);
+}
+
+/* http_parse：解析一个完整的请求头部（含把请求复制进可写缓冲区） */
+static void bench_http_parse(long n)
+{
+    http_parser_t p;
+    char buf[MAXLINE];
+    const char *req;
+    size_t len;
+    long i;
+
+    for (i = 0; i < n; i++)
+    {
+        req = requests[i % 3];
+        len = strlen(req);
+        memcpy(buf, req, len);
+        http_parser_init(&p);
+        sink += http_parse(&p, buf, len);
+    }
+}
+
+static void bench_parse_uri(long n)
+{
+    char filename[MAXLINE], cgiargs[MAXLINE];
+    long i;
+
+    for (i = 0; i < n; i++)
+        sink += parse_uri(uris[i % 6], filename, cgiargs);
+}
+
+static void bench_get_filetype(long n)
+{
+    char filetype[MAXLINE];
+    long i;
+
+    for (i = 0; i < n; i++)
+    {
+        get_filetype(filenames[i % 6], filetype);
+        sink += filetype[0];
+    }
+}
+
+static void bench_form_parse(long n)
+{
+    form_t f;
+    size_t len = strlen(form);
+    long i;
+
+    for (i = 0; i < n; i++)
+    {
+        arena_reset();
+        sink += form_parse(&f, form, len);
+    }
+}
+
+/* 不断读出并丢弃数据 */
+static void *drainer(void *arg)
+{
+    char buf[MAXBUF];
+    int fd = (int)(long)arg;
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    return NULL;
+}
+
+/* clienterror：构造并发送一个错误页面，对端由线程读出丢弃 */
+static void bench_clienterror(long n)
+{
+    conn_t c;
+    request_t rq;
+    pthread_t tid;
+    int fds[2];
+    long i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        unix_error("micro: socketpair error");
+    Pthread_create(&tid, NULL, drainer, (void *)(long)fds[1]);
+    memset(&rq, 0, sizeof(rq));
+    rq.conn = &c;
+    rq.fd = fds[0];
+    for (i = 0; i < n; i++)
+    {
+        rq.keepalive = 1;
+        clienterror(&rq, "./nope.html", "404", "Not found", "Book couldn't find this file");
+    }
+    close(fds[0]);
+    Pthread_join(tid, NULL);
+    close(fds[1]);
+}
+
+static bench_t benches[] = {
+    {"rio_readlineb/mem", bench_readline_mem, 0},
+    {"rio_readlineb/pipe", bench_readline_pipe, 0},
+    {"rio_readnb/socket", bench_readnb_socket, 4096},
+    {"http_parse", bench_http_parse, 0},
+    {"parse_uri", bench_parse_uri, 0},
+    {"get_filetype", bench_get_filetype, 0},
+    {"form_parse", bench_form_parse, 0},
+    {"clienterror", bench_clienterror, 0},
+    {NULL, NULL, 0}};
+
+/* 把请求头部重复拼接成不超过一个Rio缓冲区的输入，只取完整的请求 */
+static void corpus_init(void)
+{
+    size_t len, i, total = 0;
+    int k;
+
+    for (k = 0;; k++)
+    {
+        len = strlen(requests[k % 3]);
+        if (corpus_len + len > sizeof(corpus))
+            break;
+        memcpy(corpus + corpus_len, requests[k % 3], len);
+        corpus_len += len;
+    }
+    for (i = 0; i < corpus_len; i++)
+        corpus_lines += corpus[i] == '\n';
+    benches[0].bytes = benches[1].bytes = corpus_len / corpus_lines; // 每行的平均字节数
+    for (k = 0; k < 3; k++)
+        total += strlen(requests[k]);
+    benches[3].bytes = total / 3;
+    for (k = 0, total = 0; k < 6; k++)
+        total += strlen(uris[k]);
+    benches[4].bytes = total / 6;
+    benches[6].bytes = strlen(form);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t seconds] [name_prefix...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    double benchtime = DEF_BENCHTIME, t;
+    long n;
+    int opt, i, j, run;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1)
+    {
+        if (opt != 't' || (benchtime = atof(optarg)) <= 0)
+            usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    corpus_init();
+
+    printf("%-22s %12s %12s %10s %10s\n", "benchmark", "iterations", "ns/op", "bytes/op", "MB/s");
+    for (i = 0; benches[i].name; i++)
+    {
+        for (run = optind == argc, j = optind; j < argc && !run; j++) // 只运行名字以参数开头的测试
+            run = !strncmp(benches[i].name, argv[j], strlen(argv[j]));
+        if (!run)
+            continue;
+        for (n = 1;; n *= 2) // 逐次加倍，直到足够长
+        {
+            t = now();
+            benches[i].fn(n);
+            if ((t = now() - t) >= benchtime || n >= (1L << 40))
+                break;
+        }
+        if (benches[i].bytes)
+            printf("%-22s %12ld %12.1f %10zu %10.1f\n", benches[i].name, n, t * 1e9 / n, benches[i].bytes,
+                   benches[i].bytes * n / t / 1e6);
+        else
+            printf("%-22s %12ld %12.1f %10s %10s\n", benches[i].name, n, t * 1e9 / n, "-", "-");
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "sever.h"
+
+/*
+ * 请求信息体读取器：按Content-Length或分块传输编码，经由连接的rio缓冲区分段读出
+ * 信息体，累计长度超过config.body_max时中止。处理程序可以用body_each逐段处理，
+ * 也可以用body_buffer取得整个信息体；后者放在工作线程的复用缓冲区中，按需增长到
+ * 不超过上限，之后的请求直接复用。
+ */
+
+#define BODY_CHUNK 8192 // body_each每段的大小
+#define BODY_LINE 256   // 块长度行与尾部头部行的最大长度
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+} body_pool_t;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void pool_destroy(void *arg)
+{
+    body_pool_t *pool = arg;
+
+    free(pool->buf);
+    free(pool);
+}
+
+static void pool_key_init(void)
+{
+    pthread_key_create(&pool_key, pool_destroy);
+}
+
+/* 调用线程的复用缓冲区，容量至少为size */
+static char *pool_get(size_t size)
+{
+    body_pool_t *pool;
+
+    pthread_once(&pool_once, pool_key_init);
+    if ((pool = pthread_getspecific(pool_key)) == NULL)
+    {
+        pool = Calloc(1, sizeof(body_pool_t));
+        pthread_setspecific(pool_key, pool);
+    }
+    if (pool->size < size)
+    {
+        pool->buf = Realloc(pool->buf, size);
+        pool->size = size;
+    }
+    return pool->buf;
+}
+
+static int body_fail(body_t *b, int status, const char *reason)
+{
+    b->status = status;
+    b->reason = reason;
+    return -1;
+}
+
+/* 读取一行（块长度行、块后的CRLF或尾部头部），行过长或连接中断返回-1 */
+static int body_line(body_t *b, char *line)
+{
+    ssize_t n;
+
+    if ((n = rio_readlineb(b->rp, line, BODY_LINE)) <= 0 || line[n - 1] != '\n')
+        return -1;
+    return 0;
+}
+
+/* 读取下一块的长度行；最后一块（长度为0）之后跳过尾部头部直到空行 */
+static int body_next_chunk(body_t *b)
+{
+    char line[BODY_LINE], *end;
+    unsigned long long size;
+
+    if (body_line(b, line) < 0 || !isxdigit((unsigned char)line[0]))
+        return body_fail(b, 400, "Bad Request");
+    errno = 0;
+    size = strtoull(line, &end, 16);
+    if (errno == ERANGE || (*end != ';' && *end != '\r' && *end != '\n')) // 块扩展被忽略
+        return body_fail(b, 400, "Bad Request");
+    if (size > config.body_max - b->total)
+        return body_fail(b, 413, "Payload Too Large");
+    if (size > 0)
+    {
+        b->remain = size;
+        return 0;
+    }
+    do // 尾部头部不使用，读到空行为止
+    {
+        if (body_line(b, line) < 0)
+            return body_fail(b, 400, "Bad Request");
+    } while (strcmp(line, "\r\n") && strcmp(line, "\n"));
+    b->eof = 1;
+    return 0;
+}
+
+/*
+ * body_begin - 根据请求头部确定信息体的长度与编码，必须在读取信息体之前调用。
+ *    请求没有信息体时b->eof为1。成功返回0；长度格式错误、同时出现
+ *    Content-Length与Transfer-Encoding、不支持的传输编码或超过上限时返回-1，
+ *    status与reason给出应答的状态码，此时无法确定下一个请求的起点。
+ */
+int body_begin(body_t *b, request_t *rq)
+{
+    const char *cl = http_header(rq->hdrs, HDR_CONTENT_LENGTH);
+    const char *te = http_header(rq->hdrs, HDR_TRANSFER_ENCODING);
+    const char *expect = http_header_find(rq->hdrs, "Expect");
+    char *end;
+
+    memset(b, 0, sizeof(*b));
+    b->rp = &rq->conn->rio;
+    b->length = -1;
+    b->expect = rq->http11 && expect && !strcasecmp(expect, "100-continue"); // 客户端等待确认后才发送信息体
+    if (te && cl) // 两者并存时前后两端可能得出不同的请求边界
+        return body_fail(b, 400, "Bad Request");
+    if (te)
+    {
+        if (strcasecmp(te, "chunked")) // 只支持分块编码，其他编码无法确定信息体的长度
+            return body_fail(b, 501, "Not Implemented");
+        b->chunked = 1;
+        return 0;
+    }
+    if (cl == NULL)
+    {
+        b->eof = 1;
+        return 0;
+    }
+    errno = 0;
+    b->length = strtoll(cl, &end, 10);
+    if (!isdigit((unsigned char)cl[0]) || *end != '\0' || errno == ERANGE)
+        return body_fail(b, 400, "Bad Request");
+    if ((unsigned long long)b->length > config.body_max)
+        return body_fail(b, 413, "Payload Too Large");
+    b->remain = b->length;
+    b->eof = b->length == 0;
+    return 0;
+}
+
+/*
+ * body_read - 读出信息体的下n字节以内的数据，返回读出的字节数，信息体结束返回0。
+ *    格式错误、超过上限或连接中断返回-1。
+ */
+ssize_t body_read(body_t *b, void *buf, size_t n)
+{
+    static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    ssize_t nread;
+    char crlf[BODY_LINE];
+
+    if (b->eof)
+        return 0;
+    if (b->expect) // 第一次读取时才确认，未读取信息体就应答的请求不会让客户端白白发送
+    {
+        b->expect = 0;
+        if (rio_writen(b->rp->rio_fd, cont, sizeof(cont) - 1) < 0)
+            return body_fail(b, 400, "Bad Request");
+    }
+    if (b->chunked && b->remain == 0 && (body_next_chunk(b) < 0 || b->eof))
+        return b->eof ? 0 : -1;
+    if ((unsigned long long)n > (unsigned long long)b->remain)
+        n = b->remain;
+    if ((nread = rio_readnb(b->rp, buf, n)) != (ssize_t)n) // 信息体未到齐连接就已关闭
+        return body_fail(b, 400, "Bad Request");
+    b->remain -= nread;
+    b->total += nread;
+    if (b->remain == 0)
+    {
+        if (!b->chunked)
+            b->eof = 1;
+        else if (body_line(b, crlf) < 0 || (strcmp(crlf, "\r\n") && strcmp(crlf, "\n"))) // 块数据之后的CRLF
+            return body_fail(b, 400, "Bad Request");
+    }
+    return nread;
+}
+
+/*
+ * body_each - 以不超过BODY_CHUNK字节的段依次把信息体交给fn，内存占用与信息体大小无关。
+ *    fn返回负值时停止。全部处理完返回0，出错返回-1。
+ */
+int body_each(body_t *b, int (*fn)(void *arg, const char *data, size_t len), void *arg)
+{
+    char buf[BODY_CHUNK];
+    ssize_t n;
+
+    while ((n = body_read(b, buf, sizeof(buf))) > 0)
+        if (fn(arg, buf, n) < 0)
+            return -1;
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ * body_buffer - 读出整个信息体，返回以'\0'结尾的连续缓冲区，长度存入*len。
+ *    缓冲区属于调用线程，下一次调用时被覆盖，调用者不得释放。出错返回NULL。
+ */
+char *body_buffer(body_t *b, size_t *len)
+{
+    size_t size = b->chunked ? BODY_CHUNK : (size_t)b->remain + 1; // 分块编码时长度未知，按需加倍，最多为上限加1
+    char *buf = pool_get(size);
+    ssize_t n;
+
+    *len = 0;
+    for (;;)
+    {
+        if (*len + 1 == size && !b->eof)
+        {
+            size = size * 2 < config.body_max + 1 ? size * 2 : config.body_max + 1;
+            buf = pool_get(size);
+        }
+        if ((n = body_read(b, buf + *len, size - 1 - *len)) < 0)
+            return NULL;
+        if (n == 0)
+            break;
+        *len += n;
+    }
+    buf[*len] = '\0';
+    return buf;
+}
+
+/*
+ * body_discard - 读出并丢弃信息体的剩余部分，使连接可以继续处理下一个请求。出错返回-1。
+ *    此时最终响应已经发出，不再发送100 Continue。
+ */
+int body_discard(body_t *b)
+{
+    char buf[BODY_CHUNK];
+    ssize_t n;
+
+    b->expect = 0;
+    while ((n = body_read(b, buf, sizeof(buf))) > 0)
+        ;
+    return (int)n;
+}
@@ -1,44 +1,590 @@
-#include "csapp.h"
+#include "sever.h"
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
 
-int listenfd;
 // #define PORT 80 // 服务器默认端口号
 
-/* 函数声明 */
-void *handle_client(void *arg);
+#define DEF_QUEUE_SIZE 1024      // 线程池任务队列默认容量
+#define DEF_STACK_KB 256         // 工作线程默认栈大小（KB）
+#define DEF_KEEPALIVE_TIMEOUT 15 // 默认空闲连接超时（秒）
+#define DEF_KEEPALIVE_MAX 100    // 默认单连接请求数上限
+#define DEF_CACHE_MB 64          // 默认静态文件缓存大小（MB）
+#define DEF_SENDFILE_KB 128      // 默认零拷贝发送的文件大小阈值（KB）
+#define DEF_SESSION_TTL 1800     // 默认登录会话有效期（秒）
+#define DEF_FCGI_PROCS 2         // 默认每个FastCGI上游程序的进程数
+#define DEF_BODY_KB 1024         // 默认请求信息体上限（KB）
+#define DEF_LOG_LEVEL LOG_ACCESS // 默认日志详细程度
+#define DEF_LOG_ROTATE_MB 64     // 默认日志文件轮转阈值（MB）
+#define DEF_ACCEPTORS 1          // 默认反应堆数
+#define MAXEVENTS 1024           // 每次epoll_wait最多返回的事件数
+#define URING_ENTRIES 1024       // io_uring提交队列的容量
+#define TICK_MS 1000             // 反应堆至少每隔这么久检查一次超时（毫秒）
+
+config_t config = {DEF_KEEPALIVE_TIMEOUT, DEF_KEEPALIVE_MAX, (size_t)DEF_CACHE_MB << 20, DEF_SENDFILE_KB << 10, DEF_SESSION_TTL, 0, DEF_FCGI_PROCS, DEF_BODY_KB << 10,
+                   DEF_LOG_LEVEL, 1, (size_t)DEF_LOG_ROTATE_MB << 20, NULL, 0, 0};
+
+/*
+ * 反应堆：一个epoll实例及其监听套接字、空闲连接与归还队列，由一个线程独占运行。
+ * 多个反应堆时各自拥有一个设置了SO_REUSEPORT的监听套接字，由内核把新连接分配给
+ * 它们，每个反应堆线程绑定一个CPU；连接始终回到接受它的反应堆。
+ * 事件来源有两种后端：默认的epoll就绪通知，以及可选的io_uring完成通知（-u），
+ * 后者由内核完成accept与接收，反应堆只处理结果，内核不支持时自动退回epoll。
+ */
+typedef struct reactor
+{
+    uring_t *ring;                 // io_uring实例，NULL表示使用epoll
+    int fixed;                     // listenfd与wakefd已注册为固定文件0与1
+    int multishot;                 // 内核支持multishot accept
+    uint64_t wakebuf;              // io_uring读取eventfd的计数
+    int epfd;                      // epoll实例
+    int listenfd;                  // 监听套接字
+    int wakefd;                    // 工作线程归还连接时用于唤醒反应堆的eventfd
+    int cpu;                       // 绑定到第几个可用CPU，-1表示不绑定
+    conn_t idle;                   // 在反应堆中等待数据的连接，按截止时间升序排列的循环链表
+    conn_t *returned;              // 工作线程交还、尚未重新注册的连接
+    pthread_mutex_t returned_lock; // 保护returned
+} reactor_t;
+
+static reactor_t *reactors; // 全部反应堆，第一个由主线程运行
+static int nreactors = DEF_ACCEPTORS;
+static threadpool_t *pool; // 处理请求的线程池
+static volatile sig_atomic_t stopping; // 收到终止信号，主反应堆退出事件循环
+
+/*
+ * 信号处理程序只能调用异步信号安全的函数：这里只置标志并写eventfd唤醒主反应堆，
+ * 统计信息的输出与退出由main在事件循环结束后完成
+ */
 void sigint_handler(int sig)
 {
-    close(listenfd);
-    printf("\nProgram is terminated.\n");
+    uint64_t one = 1;
+    int saved = errno;
+
+    stopping = 1;
+    if (reactors && reactors[0].wakefd > 0) // 主反应堆尚未创建时，事件循环开始后会看到标志
+        write(reactors[0].wakefd, &one, sizeof(one));
+    errno = saved;
+}
+
+/* 主反应堆退出后：停止接受连接，输出统计信息并退出（atexit清理日志与FastCGI上游进程） */
+static void shutdown_server(void)
+{
+    cache_stats_t st;
+    int i;
+
+    for (i = 0; i < nreactors; i++)
+        close(reactors[i].listenfd);
+    cache_getstats(&st);
+    printf("\nCache: %lu hits, %lu misses, %lu evictions, %zu entries, %zu bytes\n",
+           st.hits, st.misses, st.evictions, st.entries, st.bytes);
+    printf("Log: %lu records dropped\n", log_dropped());
+    printf("Program is terminated.\n");
     exit(0);
 }
-int main(int argc, char **argv)
+void usage(const char *prog)
 {
-    signal(SIGTSTP, sigint_handler);
-    signal(SIGINT, sigint_handler);
-    int connfd;                            // 监听套接字和连接套接字描述符char hostname[MAXLINE], port[MAXLINE]; // 客户端主机名与端口号
-    char hostname[MAXLINE], port[MAXLINE]; // 客户端主机名与端口号
-    socklen_t clientlen;                   // 记录客户端地址长度
-    struct sockaddr_storage clientaddr;    // 存储客户端地址信息的结构体
+    fprintf(stderr, "usage: %s <port> [-t threads] [-q queue_size] [-s stack_kb] "
+                    "[-k keepalive_timeout] [-m max_requests] [-c cache_mb] [-z sendfile_kb] [-e session_ttl] [-x] [-f route=fastcgi_program] [-p fastcgi_procs] [-b body_kb] "
+                    "[-l log_file] [-v log_level] [-n log_sample] [-r log_rotate_mb] [-H] [-M] [-a acceptors] [-d defer_accept_sec] [-o fastopen_qlen] [-u]\n",
+            prog);
+    exit(1);
+}
+
+/* 单调时钟的当前秒数，不受系统时间调整影响 */
+static time_t now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* 将描述符设为非阻塞，并在exec时自动关闭（避免泄漏给CGI子进程） */
+static void setnonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* 空闲链表操作，只在连接所属的反应堆线程中调用 */
+static void idle_append(conn_t *c)
+{
+    conn_t *idle = &c->reactor->idle;
+
+    c->expire = now_sec() + config.keepalive_timeout;
+    c->prev = idle->prev;
+    c->next = idle;
+    idle->prev->next = c;
+    idle->prev = c;
+}
+
+static void idle_remove(conn_t *c)
+{
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    c->prev = c->next = c; // 重复移除时什么也不做
+}
+
+/*
+ * 以边沿触发+一次性方式监听连接的可读事件：事件触发后连接归当前处理者独占，直到再次注册。
+ * io_uring后端改为提交一个接收请求，数据直接进入rio缓冲区的空闲尾部。
+ */
+static int conn_arm(conn_t *c, int op)
+{
+    struct epoll_event ev;
+    rio_t *rp = &c->rio;
+
+    if (c->reactor->ring)
+    {
+        if (rp->rio_bufptr != rp->rio_buf) // 压缩缓冲区，为新数据腾出尾部空间
+        {
+            memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+            rp->rio_bufptr = rp->rio_buf;
+        }
+        if (rp->rio_cnt == RIO_BUFSIZE ||
+            uring_recv(c->reactor->ring, c->fd, rp->rio_buf + rp->rio_cnt, RIO_BUFSIZE - rp->rio_cnt, c) < 0)
+            return -1;
+        return 0;
+    }
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(c->reactor->epfd, op, c->fd, &ev) < 0)
+    {
+        fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void conn_close(conn_t *c)
+{
+    close(c->fd); // 关闭描述符时内核会自动将其移出epoll
+    free(c);
+    metrics_add(M_CONN_CLOSED, 1);
+}
+
+/* 由工作线程调用：把连接放入所属反应堆的归还队列并唤醒它，由反应堆线程统一重新注册和计时 */
+void conn_idle(conn_t *c)
+{
+    reactor_t *r = c->reactor;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&r->returned_lock);
+    c->next = r->returned;
+    r->returned = c;
+    pthread_mutex_unlock(&r->returned_lock);
+    write(r->wakefd, &one, sizeof(one));
+}
+
+/* 反应堆接管一个等待请求的连接：开始计时并注册可读事件 */
+static void conn_wait(conn_t *c, int op)
+{
+    if (conn_arm(c, op) < 0)
+    {
+        conn_close(c);
+        return;
+    }
+    idle_append(c);
+}
+
+/* 重新接管工作线程交还的全部连接 */
+static void take_returned(reactor_t *r)
+{
+    uint64_t cnt;
+    conn_t *c, *next;
+
+    if (!r->ring) // io_uring后端已经读过eventfd
+        read(r->wakefd, &cnt, sizeof(cnt));
+    pthread_mutex_lock(&r->returned_lock);
+    c = r->returned;
+    r->returned = NULL;
+    pthread_mutex_unlock(&r->returned_lock);
 
-    if (argc != 2) // 命令行参数检查
+    for (; c; c = next)
     {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]); // 输出错误提示信息
-        exit(1);
+        next = c->next;
+        conn_wait(c, EPOLL_CTL_MOD);
     }
+}
+
+/* 关闭所有已超时的空闲连接 */
+static void sweep_idle(reactor_t *r)
+{
+    time_t now = now_sec();
+    conn_t *c;
 
-    listenfd = Open_listenfd(argv[1]); // 创建监听套接字并返回描述符
-    while (1)                          // 循环监听并处理客户端请求
+    while ((c = r->idle.next) != &r->idle && c->expire <= now)
+    {
+        idle_remove(c);
+        if (r->ring) // 内核中还有该连接的接收请求，关闭读写两端使其以0完成，届时再释放连接
+            shutdown(c->fd, SHUT_RDWR);
+        else
+            conn_close(c);
+    }
+}
+
+/* 为新接受的连接connfd创建conn_t，交给反应堆r等待请求 */
+static void conn_new(reactor_t *r, int connfd, struct sockaddr *addr, socklen_t addrlen)
+{
+    char port[NI_MAXSERV]; // 客户端端口号
+    conn_t *c;
+
+    metrics_add(M_CONN_ACCEPTED, 1);
+    c = Malloc(sizeof(conn_t));
+    if (getnameinfo(addr, addrlen, c->peer, sizeof(c->peer), port, sizeof(port),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0) // 只取数字地址，反向解析DNS可能阻塞数秒
+        strcpy(c->peer, "-");
+    log_verbose("Accepted connection from (%s, %s)", c->peer, port); // 记录客户端信息
+    c->reactor = r;
+    c->fd = connfd;
+    c->nreq = 0;
+    rio_readinitb(&c->rio, connfd);
+    http_parser_init(&c->parser);
+    conn_wait(c, EPOLL_CTL_ADD);
+}
+
+/* 监听套接字可读：循环accept直到没有新的连接 */
+static void accept_conns(reactor_t *r)
+{
+    int connfd;                         // 连接套接字描述符
+    socklen_t clientlen;                // 记录客户端地址长度
+    struct sockaddr_storage clientaddr; // 存储客户端地址信息的结构体
+
+    for (;;)
     {
         clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);                       // 接受客户端请求，返回连接描述符
-        Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0); // 获取客户端主机名和端口号
-        printf("Accepted connection from (%s, %s)\n", hostname, port);                  // 打印客户端信息
+        if ((connfd = accept_nonblock(r->listenfd, (SA *)&clientaddr, &clientlen)) < 0) // 接受客户端请求，返回非阻塞的连接描述符
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                fprintf(stderr, "accept error: %s\n", strerror(errno));
+            return;
+        }
+        conn_new(r, connfd, (SA *)&clientaddr, clientlen);
+    }
+}
+
+/*
+ * 连接的rio缓冲区中有了新数据（n为缓冲区中的字节数，0表示对端已关闭且缓冲区已空，-1表示出错）：
+ * 继续解析，请求头部完整（或确定有误）后才交给线程池
+ */
+static void conn_readable(conn_t *c, ssize_t n)
+{
+    static const char too_large[] = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                                    "Connection: close\r\n"
+                                    "Content-length: 0\r\n\r\n";
+
+    if (n > 0)
+    {
+        if (http_parse(&c->parser, c->rio.rio_bufptr, c->rio.rio_cnt) != 0) // 出错的请求由工作线程应答后关闭
+        {
+            idle_remove(c);                         // 连接离开反应堆，不再计时
+            Threadpool_add(pool, handle_client, c); // 队列已满时会阻塞反应堆，把压力反馈到内核的连接队列
+            return;
+        }
+        if (n < RIO_BUFSIZE && !c->rio.rio_eof && conn_arm(c, EPOLL_CTL_MOD) == 0)
+            return; // 头部尚不完整，留在空闲链表中等待更多数据，截止时间不延长以防慢速发送拖住连接
+        if (n == RIO_BUFSIZE) // 缓冲区已满仍未读到完整头部
+            write(c->fd, too_large, sizeof(too_large) - 1);
+    }
+    idle_remove(c); // 对端关闭、出错或头部过大
+    conn_close(c);
+}
+
+/*
+ * 创建反应堆r：监听套接字（多个反应堆时设置SO_REUSEPORT）、唤醒用的eventfd，
+ * 以及io_uring实例（use_uring为真且内核支持时）或epoll实例
+ */
+static void reactor_open(reactor_t *r, const char *port, int defer_accept, int fastopen, int use_uring)
+{
+    struct epoll_event ev;
+    int fds[2];
+
+    r->listenfd = Open_listenfd_opt(port, nreactors > 1); // 创建监听套接字并返回描述符
+    setnonblocking(r->listenfd);
+    if (defer_accept > 0 && setsockopt(r->listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(int)) < 0) // 数据到达后才唤醒accept
+        fprintf(stderr, "TCP_DEFER_ACCEPT: %s\n", strerror(errno));
+    if (fastopen > 0 && setsockopt(r->listenfd, IPPROTO_TCP, TCP_FASTOPEN, &fastopen, sizeof(int)) < 0) // 允许在SYN中携带请求
+        fprintf(stderr, "TCP_FASTOPEN: %s\n", strerror(errno));
+
+    if ((r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        unix_error("eventfd error");
+    r->idle.prev = r->idle.next = &r->idle;
+    r->returned = NULL;
+    pthread_mutex_init(&r->returned_lock, NULL);
+
+    if (use_uring && (r->ring = uring_open(URING_ENTRIES)) == NULL && r == reactors)
+        fprintf(stderr, "io_uring is not available, falling back to epoll\n");
+    if (r->ring)
+    {
+        fds[0] = r->listenfd;
+        fds[1] = r->wakefd;
+        r->fixed = uring_register_files(r->ring, fds, 2) == 0;
+        r->multishot = 1; // 内核不支持时第一次accept以EINVAL完成，届时改为单次accept
+        r->epfd = -1;
+        return;
+    }
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_client, &connfd) != 0)
+    if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    ev.events = EPOLLIN;        // 监听套接字使用水平触发，每次就绪时accept到EAGAIN为止
+    ev.data.ptr = &r->listenfd; // data.ptr指向listenfd/wakefd表示对应的描述符，否则为conn_t
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listenfd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    ev.data.ptr = &r->wakefd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) < 0)
+        unix_error("epoll_ctl error");
+}
+
+/* 定期工作：回收超时的空闲连接；过期会话只由第一个反应堆清理 */
+static void reactor_tick(reactor_t *r)
+{
+    sweep_idle(r);
+    if (r == reactors)
+        session_sweep();
+}
+
+/* epoll后端的事件循环：接受新连接、读取请求头部、回收空闲连接 */
+static void reactor_epoll(reactor_t *r)
+{
+    struct epoll_event events[MAXEVENTS]; // epoll_wait返回的就绪事件
+    conn_t *c;
+    int i, n;
+
+    while (!stopping || r != reactors) // 只有主反应堆响应终止信号
+    {
+        if ((n = epoll_wait(r->epfd, events, MAXEVENTS, TICK_MS)) < 0) // 至少每秒醒来一次检查超时
         {
-            perror("pthread_create failed");
-            exit(EXIT_FAILURE);
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
         }
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == &r->listenfd)
+                accept_conns(r);
+            else if (events[i].data.ptr == &r->wakefd)
+                take_returned(r);
+            else
+            {
+                c = events[i].data.ptr;
+                conn_readable(c, rio_fillb(&c->rio));
+            }
+        }
+        reactor_tick(r);
     }
-}
\ No newline at end of file
+}
+
+/* io_uring后端：重新提交accept（what为&r->listenfd）、eventfd读取（&r->wakefd）或定时器（&r->ring） */
+static void uring_rearm(reactor_t *r, void *what)
+{
+    int rc;
+
+    if (what == &r->listenfd)
+        rc = uring_accept(r->ring, r->fixed ? 0 : r->listenfd, r->fixed, r->multishot, what);
+    else if (what == &r->wakefd)
+        rc = uring_read(r->ring, r->fixed ? 1 : r->wakefd, r->fixed, &r->wakebuf, sizeof(r->wakebuf), what);
+    else
+        rc = uring_timeout(r->ring, TICK_MS, what);
+    if (rc < 0)
+        unix_error("io_uring submit error");
+}
+
+/* io_uring后端：accept完成，res为新连接的描述符或-errno，more为假时须重新提交 */
+static void uring_accepted(reactor_t *r, int res, int more)
+{
+    struct sockaddr_storage clientaddr;
+    socklen_t clientlen = sizeof(clientaddr);
+
+    if (res >= 0)
+    {
+        if (getpeername(res, (SA *)&clientaddr, &clientlen) == 0) // multishot accept不返回对端地址
+            conn_new(r, res, (SA *)&clientaddr, clientlen);
+        else
+            close(res);
+    }
+    else if (res == -EINVAL && r->multishot) // 5.19之前的内核不支持multishot accept
+        r->multishot = 0;
+    else
+        fprintf(stderr, "accept error: %s\n", strerror(-res));
+    if (!more)
+        uring_rearm(r, &r->listenfd);
+}
+
+/*
+ * io_uring后端的事件循环：accept、接收与eventfd读取都由内核完成，反应堆只处理完成事件，
+ * 新提交的请求在下一次等待时与等待合并为一次系统调用
+ */
+static void reactor_uring(reactor_t *r)
+{
+    conn_t *c;
+    void *data;
+    int res, more;
+
+    uring_rearm(r, &r->listenfd);
+    uring_rearm(r, &r->wakefd);
+    uring_rearm(r, &r->ring);
+    while (!stopping || r != reactors) // 只有主反应堆响应终止信号
+    {
+        if (uring_wait(r->ring) < 0)
+            unix_error("io_uring_enter error");
+        while (uring_next(r->ring, &data, &res, &more))
+        {
+            if (data == &r->listenfd)
+                uring_accepted(r, res, more);
+            else if (data == &r->wakefd)
+            {
+                take_returned(r);
+                uring_rearm(r, data);
+            }
+            else if (data == &r->ring)
+            {
+                reactor_tick(r);
+                uring_rearm(r, data);
+            }
+            else // 接收完成：res为接收的字节数，0为对端关闭（或已被sweep_idle关闭），负值为错误
+            {
+                c = data;
+                conn_readable(c, res > 0 ? (c->rio.rio_cnt += res) : res == 0 ? 0 : -1);
+            }
+        }
+    }
+}
+
+static void *reactor_run(void *arg)
+{
+    reactor_t *r = arg;
+
+    if (r->cpu >= 0 && thread_pin(r->cpu) < 0)
+        fprintf(stderr, "cannot pin reactor %d to a CPU: %s\n", r->cpu, strerror(errno));
+    if (r->ring)
+        reactor_uring(r);
+    else
+        reactor_epoll(r);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGTSTP, sigint_handler);
+    signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);          // 正常退出，以便清理FastCGI上游进程
+    signal(SIGPIPE, SIG_IGN);                 // 客户端提前断开时不让写操作终止整个进程
+    pthread_t tid;
+    int i;
+
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN) * 2; // 工作线程数，默认为CPU核数的两倍
+    int queue_size = DEF_QUEUE_SIZE;                  // 任务队列容量
+    int stack_kb = DEF_STACK_KB;                      // 工作线程栈大小
+    int defer_accept = 0; // TCP_DEFER_ACCEPT的秒数，0表示不设置
+    int fastopen = 0;     // TCP_FASTOPEN的队列长度，0表示不启用
+    int use_uring = 0;    // 使用io_uring后端
+    int opt;
+
+    if (argc < 2 || argv[1][0] == '-') // 命令行参数检查，第一个参数必须是端口号
+        usage(argv[0]);
+    optind = 2;
+    while ((opt = getopt(argc, argv, "t:q:s:k:m:c:z:e:xf:p:b:l:v:n:r:HMa:d:o:u")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'q':
+            queue_size = atoi(optarg);
+            break;
+        case 's':
+            stack_kb = atoi(optarg);
+            break;
+        case 'k':
+            config.keepalive_timeout = atoi(optarg);
+            break;
+        case 'm':
+            config.keepalive_max = atoi(optarg);
+            break;
+        case 'c':
+            config.cache_bytes = (size_t)atol(optarg) << 20;
+            break;
+        case 'z':
+            config.sendfile_min = (off_t)atol(optarg) << 10;
+            break;
+        case 'e':
+            config.session_ttl = atoi(optarg);
+            break;
+        case 'x': // 启用外部CGI程序
+            config.cgi = 1;
+            break;
+        case 'f': // 可重复指定多个FastCGI上游程序
+            if (fcgi_add(optarg) < 0)
+                usage(argv[0]);
+            break;
+        case 'p':
+            config.fcgi_procs = atoi(optarg);
+            break;
+        case 'b':
+            config.body_max = (size_t)atol(optarg) << 10;
+            break;
+        case 'l':
+            config.log_path = optarg;
+            break;
+        case 'v': // 0不记录，1访问日志，2另加调试信息
+            config.log_level = atoi(optarg);
+            break;
+        case 'n': // 每n个请求记录一个
+            config.log_sample = atoi(optarg);
+            break;
+        case 'r': // 0表示不轮转
+            config.log_rotate = (size_t)atol(optarg) << 20;
+            break;
+        case 'H': // 访问日志记录主机名，由后台线程反向解析
+            config.log_hostnames = 1;
+            break;
+        case 'M': // 允许其他主机抓取/metrics
+            config.metrics_public = 1;
+            break;
+        case 'a': // 反应堆数，大于1时每个反应堆一个SO_REUSEPORT监听套接字并绑定一个CPU
+            nreactors = atoi(optarg);
+            break;
+        case 'd':
+            defer_accept = atoi(optarg);
+            break;
+        case 'o':
+            fastopen = atoi(optarg);
+            break;
+        case 'u': // 内核不支持时退回epoll
+            use_uring = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (nthreads <= 0 || queue_size <= 0 || stack_kb < 0 || config.keepalive_timeout <= 0 || config.keepalive_max <= 0 || config.session_ttl <= 0 || config.fcgi_procs <= 0 || config.body_max == 0 ||
+        config.log_level < LOG_OFF || config.log_level > LOG_VERBOSE || config.log_sample <= 0 ||
+        nreactors <= 0 || defer_accept < 0 || fastopen < 0)
+        usage(argv[0]);
+
+    log_init(); // 刷新线程先于其他线程启动
+    if (config.log_hostnames)
+        resolve_init();
+    cache_init(config.cache_bytes);
+    session_init();
+    routes_init(); // 站点的默认路由，之后注册的同名路由覆盖它们
+    handler_init();
+    metrics_init();
+    fcgi_init(); // 在创建线程池之前派生上游进程
+    pool = Threadpool_create(nthreads, queue_size, (size_t)stack_kb * 1024);
+    reactors = Calloc(nreactors, sizeof(reactor_t));
+    for (i = 0; i < nreactors; i++)
+    {
+        reactors[i].cpu = nreactors > 1 ? i : -1; // 只有一个反应堆时不绑定
+        reactor_open(&reactors[i], argv[1], defer_accept, fastopen, use_uring);
+    }
+    for (i = 1; i < nreactors; i++)
+    {
+        Pthread_create(&tid, NULL, reactor_run, &reactors[i]);
+        Pthread_detach(tid);
+    }
+    reactor_run(&reactors[0]);
+    shutdown_server();
+}
@@ -0,0 +1,280 @@
+#include "sever.h"
+
+/*
+ * 静态文件缓存：按文件路径分片的LRU缓存，总字节数受config.cache_bytes限制。
+ * 每个条目保存文件内容（及其压缩版本）和序列化好的响应头部，命中时无需打开/映射文件，也无需重新格式化头部。
+ * 条目带引用计数，工作线程在锁外发送数据期间条目即使被淘汰也不会被释放。
+ */
+
+#define CACHE_SHARDS 16   // 分片数，降低多线程下的锁竞争
+#define CACHE_BUCKETS 256 // 每个分片的哈希桶数
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    cache_entry_t *buckets[CACHE_BUCKETS]; // 哈希表，冲突时用链表
+    cache_entry_t lru;                     // LRU循环链表表头，lru.next为最近使用
+    size_t bytes;                          // 本分片已占用的字节数
+    size_t capacity;                       // 本分片的字节上限
+    unsigned long hits, misses, evictions; // 统计计数
+} cache_shard_t;
+
+static cache_shard_t shards[CACHE_SHARDS];
+static int cache_enabled;
+
+/* FNV-1a字符串哈希 */
+static unsigned int cache_hash(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static cache_shard_t *cache_shard(unsigned int hash)
+{
+    return &shards[(hash >> 24) % CACHE_SHARDS]; // 高位选分片，低位选桶，两者相互独立
+}
+
+static void variants_free(cache_variant_t *var)
+{
+    int i;
+
+    for (i = 0; i < ENC_COUNT; i++)
+    {
+        free(var[i].hdr);
+        free(var[i].body);
+    }
+}
+
+static void entry_free(cache_entry_t *e)
+{
+    free(e->path);
+    variants_free(e->var);
+    free(e);
+}
+
+/* 以下函数需持有分片锁 */
+static void lru_unlink(cache_entry_t *e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void lru_push(cache_shard_t *sh, cache_entry_t *e)
+{
+    e->prev = &sh->lru;
+    e->next = sh->lru.next;
+    sh->lru.next->prev = e;
+    sh->lru.next = e;
+}
+
+/* 把条目移出哈希表与LRU链表；仍被引用时延迟到最后一次cache_release再释放 */
+static void entry_remove(cache_shard_t *sh, cache_entry_t *e)
+{
+    cache_entry_t **pp = &sh->buckets[e->hash % CACHE_BUCKETS];
+
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    lru_unlink(e);
+    sh->bytes -= e->charge;
+    e->removed = 1;
+    if (e->refcnt == 0)
+        entry_free(e);
+}
+
+/* 文件自缓存以来是否被修改过 */
+static int entry_fresh(const cache_entry_t *e, const struct stat *sbuf)
+{
+    return e->size == sbuf->st_size && e->ino == sbuf->st_ino &&
+           e->mtime.tv_sec == sbuf->st_mtim.tv_sec && e->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+/* cache_init - 初始化缓存，capacity为总字节上限，为0时禁用缓存 */
+void cache_init(size_t capacity)
+{
+    int i;
+
+    cache_enabled = capacity > 0;
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].lru.prev = shards[i].lru.next = &shards[i].lru;
+        shards[i].capacity = capacity / CACHE_SHARDS;
+    }
+}
+
+/* cache_admits - 大小为size的文件能否放入缓存，用于在读文件前排除过大的文件 */
+int cache_admits(size_t size)
+{
+    return cache_enabled && size + sizeof(cache_entry_t) + MAXBUF <= shards[0].capacity;
+}
+
+/*
+ * cache_lookup - 查找与sbuf描述的文件版本一致的缓存条目。
+ *    命中时返回已增加引用计数的条目，使用完毕后须调用cache_release；未命中返回NULL。
+ *    文件已被修改的旧条目会被顺带移除。
+ */
+cache_entry_t *cache_lookup(const char *path, const struct stat *sbuf)
+{
+    unsigned int hash;
+    cache_shard_t *sh;
+    cache_entry_t *e;
+
+    if (!cache_enabled)
+        return NULL;
+    hash = cache_hash(path);
+    sh = cache_shard(hash);
+
+    pthread_mutex_lock(&sh->lock);
+    for (e = sh->buckets[hash % CACHE_BUCKETS]; e; e = e->hnext)
+        if (e->hash == hash && !strcmp(e->path, path))
+            break;
+    if (e && !entry_fresh(e, sbuf)) // 文件已变化，丢弃旧版本
+    {
+        entry_remove(sh, e);
+        e = NULL;
+    }
+    if (e)
+    {
+        lru_unlink(e); // 移到LRU表头
+        lru_push(sh, e);
+        e->refcnt++;
+        sh->hits++;
+    }
+    else
+        sh->misses++;
+    pthread_mutex_unlock(&sh->lock);
+    return e;
+}
+
+/*
+ * cache_insert - 将文件的各编码版本（内容及其响应头部）及其ETag放入缓存，var[ENC_COUNT]
+ *    中各缓冲区的所有权转移给缓存。返回已增加引用计数的条目；条目超过分片容量
+ *    而无法缓存时返回NULL，此时各缓冲区仍归调用者所有。
+ */
+cache_entry_t *cache_insert(const char *path, const struct stat *sbuf, cache_variant_t *var, const char *etag)
+{
+    unsigned int hash;
+    cache_shard_t *sh;
+    cache_entry_t *e, *old;
+    size_t charge = sizeof(cache_entry_t) + strlen(path) + 1;
+    int i;
+
+    for (i = 0; i < ENC_COUNT; i++)
+        charge += var[i].hdrlen + var[i].bodylen;
+
+    if (!cache_enabled)
+        return NULL;
+    hash = cache_hash(path);
+    sh = cache_shard(hash);
+    if (charge > sh->capacity)
+        return NULL;
+
+    e = Calloc(1, sizeof(cache_entry_t));
+    e->path = strdup(path);
+    e->hash = hash;
+    e->size = sbuf->st_size;
+    e->ino = sbuf->st_ino;
+    e->mtime = sbuf->st_mtim;
+    memcpy(e->var, var, sizeof(e->var));
+    memcpy(e->etag, etag, ETAG_LEN);
+    e->charge = charge;
+    e->refcnt = 1; // 调用者持有的引用
+
+    pthread_mutex_lock(&sh->lock);
+    for (old = sh->buckets[hash % CACHE_BUCKETS]; old; old = old->hnext) // 其他线程可能已插入同一文件
+        if (old->hash == hash && !strcmp(old->path, path))
+        {
+            entry_remove(sh, old);
+            break;
+        }
+    while (sh->bytes + charge > sh->capacity) // 从LRU表尾开始淘汰，直到有足够空间
+    {
+        entry_remove(sh, sh->lru.prev);
+        sh->evictions++;
+    }
+    e->hnext = sh->buckets[hash % CACHE_BUCKETS];
+    sh->buckets[hash % CACHE_BUCKETS] = e;
+    lru_push(sh, e);
+    sh->bytes += charge;
+    pthread_mutex_unlock(&sh->lock);
+    return e;
+}
+
+/* cache_release - 释放cache_lookup/cache_insert返回的引用 */
+void cache_release(cache_entry_t *e)
+{
+    cache_shard_t *sh = cache_shard(e->hash);
+
+    pthread_mutex_lock(&sh->lock);
+    if (--e->refcnt == 0 && e->removed)
+        entry_free(e);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* cache_getstats - 汇总各分片的统计计数 */
+void cache_getstats(cache_stats_t *st)
+{
+    cache_entry_t *e;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        st->hits += shards[i].hits;
+        st->misses += shards[i].misses;
+        st->evictions += shards[i].evictions;
+        st->bytes += shards[i].bytes;
+        for (e = shards[i].lru.next; e != &shards[i].lru; e = e->next)
+            st->entries++;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+/*
+ * 强ETag：已缓存的文件由内存中的内容计算哈希，保存在缓存条目中；不经过缓存、
+ * 用sendfile发送的大文件不读取内容，由标识文件版本的大小、i节点与纳秒级修改时间计算。
+ */
+
+/* 内容哈希：每次处理8字节，比逐字节的FNV快得多，用于生成强ETag而非安全用途 */
+static unsigned long long content_hash(const unsigned char *p, size_t len)
+{
+    unsigned long long h = 0xcbf29ce484222325ull ^ len, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8)
+    {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    h ^= h >> 32;
+    return h * 0xff51afd7ed558ccdull;
+}
+
+/* etag_compute - 由文件内容计算强ETag（含引号）存入tag */
+void etag_compute(const void *body, size_t len, char *tag)
+{
+    snprintf(tag, ETAG_LEN, "\"%016llx\"", content_hash(body, len));
+}
+
+/* etag_identity - 由文件版本（大小、i节点、修改时间）计算强ETag存入tag，不做任何文件I/O */
+void etag_identity(const struct stat *sbuf, char *tag)
+{
+    unsigned long long id[4];
+
+    id[0] = sbuf->st_size;
+    id[1] = sbuf->st_ino;
+    id[2] = sbuf->st_mtim.tv_sec;
+    id[3] = sbuf->st_mtim.tv_nsec;
+    etag_compute(id, sizeof(id), tag);
+}
@@ -1,24 +1,23 @@
 #include "csapp.h"
 
-int main(void)
+/*
+ * 加法计算程序。默认编译为CGI程序，每个请求运行一次；
+ * 定义FASTCGI编译时成为常驻的FastCGI应用程序，由服务器用 -f 选项启动。
+ */
+
+/* 按查询串"n1&n2"计算，把CGI输出写入out，返回其长度 */
+static int calculate(const char *buf, char *out, size_t size)
 {
-    char *buf, *p;
+    const char *p;
     int n1, n2, sum;
 
     // 从环境变量QUERY_STRING中获取参数
-    if ((buf = getenv("QUERY_STRING")) == NULL)
-    {
-        printf("QUERY_STRING is empty\n");
-        exit(0);
-    }
+    if (buf == NULL)
+        return snprintf(out, size, "QUERY_STRING is empty\n");
 
     // 解析参数
     if ((p = strchr(buf, '&')) == NULL)
-    {
-        printf("invalid query string: %s\n", buf);
-        exit(0);
-    }
-    *p = '\0';
+        return snprintf(out, size, "invalid query string: %s\n", buf);
     n1 = atoi(buf);
     n2 = atoi(p + 1);
 
@@ -27,10 +26,192 @@ int main(void)
     // printf("Content-type: text/html\r\n\r\n");
     // printf("<html><head><title>Sum</title></head>\n");
     // printf("<body><p>%d + %d = %d</p></body></html>\n", n1, n2, sum);
-    printf("HTTP/1.0 200 OK\r\n"); 
-    printf("Content-type:application/json\r\n\r\n");
-    printf("sum=%d", sum);
+    return snprintf(out, size, "HTTP/1.0 200 OK\r\n"
+                               "Content-type:application/json\r\n\r\n"
+                               "sum=%d",
+                    sum);
+}
+
+#ifndef FASTCGI
+
+int main(void)
+{
+    char out[MAXLINE];
+    int n;
+
+    n = calculate(getenv("QUERY_STRING"), out, sizeof(out));
+    fwrite(out, 1, n < (int)sizeof(out) ? n : (int)sizeof(out) - 1, stdout);
     fflush(stdout);
 
     return 0;
-}
\ No newline at end of file
+}
+
+#else /* FASTCGI */
+
+#include "fastcgi.h"
+
+/* 读满n字节，对端关闭或出错时返回-1 */
+static int read_full(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0)
+    {
+        if ((r = read(fd, p, n)) <= 0)
+        {
+            if (r < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    ssize_t w;
+
+    while (n > 0)
+    {
+        if ((w = write(fd, p, n)) <= 0)
+        {
+            if (w < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* 读取一个名值对的长度 */
+static size_t param_len(const unsigned char **p)
+{
+    size_t len = *(*p)++;
+
+    if (len & 0x80) // 4字节长度
+    {
+        len = ((len & 0x7f) << 24) | ((*p)[0] << 16) | ((*p)[1] << 8) | (*p)[2];
+        *p += 3;
+    }
+    return len;
+}
+
+/* 在PARAMS数据中查找参数name，值复制到value */
+static int param_get(const unsigned char *params, size_t plen, const char *name, char *value, size_t size)
+{
+    const unsigned char *p = params, *end = params + plen;
+    size_t nlen, vlen;
+
+    while (p < end)
+    {
+        nlen = param_len(&p);
+        vlen = param_len(&p);
+        if (p + nlen + vlen > end)
+            break;
+        if (nlen == strlen(name) && !memcmp(p, name, nlen))
+        {
+            if (vlen >= size)
+                vlen = size - 1;
+            memcpy(value, p + nlen, vlen);
+            value[vlen] = '\0';
+            return 0;
+        }
+        p += nlen + vlen;
+    }
+    return -1;
+}
+
+/* 发送一个请求的输出与结束记录 */
+static int respond(int fd, int id, const char *out, int n)
+{
+    unsigned char buf[FCGI_HEADER_LEN * 3 + sizeof(FCGI_EndRequestBody) + MAXLINE];
+    FCGI_EndRequestBody *end;
+    int len = 0;
+
+    fcgi_header((FCGI_Header *)buf, FCGI_STDOUT, id, n);
+    memcpy(buf + FCGI_HEADER_LEN, out, n);
+    len = FCGI_HEADER_LEN + n;
+    fcgi_header((FCGI_Header *)(buf + len), FCGI_STDOUT, id, 0); // 输出结束
+    len += FCGI_HEADER_LEN;
+    fcgi_header((FCGI_Header *)(buf + len), FCGI_END_REQUEST, id, sizeof(*end));
+    len += FCGI_HEADER_LEN;
+    end = (FCGI_EndRequestBody *)(buf + len);
+    memset(end, 0, sizeof(*end));
+    end->protocolStatus = FCGI_REQUEST_COMPLETE;
+    len += sizeof(*end);
+    return write_full(fd, buf, len);
+}
+
+/* 处理一个连接上的请求，直到服务器关闭连接或请求不要求保持连接 */
+static void serve_conn(int fd)
+{
+    FCGI_Header h;
+    FCGI_BeginRequestBody *begin;
+    unsigned char rec[FCGI_MAX_CONTENT + 255], params[MAXLINE];
+    char query[MAXLINE], out[MAXLINE];
+    size_t plen = 0;
+    int id = 0, keep = 0, len, n, has_query = 0;
+
+    while (read_full(fd, &h, sizeof(h)) == 0)
+    {
+        len = (h.contentLengthB1 << 8) | h.contentLengthB0;
+        if (read_full(fd, rec, len + h.paddingLength) < 0)
+            return;
+        switch (h.type)
+        {
+        case FCGI_BEGIN_REQUEST:
+            begin = (FCGI_BeginRequestBody *)rec;
+            id = (h.requestIdB1 << 8) | h.requestIdB0;
+            keep = begin->flags & FCGI_KEEP_CONN;
+            plen = 0;
+            break;
+        case FCGI_PARAMS:
+            if (len > 0) // 收集参数，空记录表示参数结束
+            {
+                if (plen + len <= sizeof(params))
+                {
+                    memcpy(params + plen, rec, len);
+                    plen += len;
+                }
+                break;
+            }
+            has_query = param_get(params, plen, "QUERY_STRING", query, sizeof(query)) == 0;
+            break;
+        case FCGI_STDIN:
+            if (len > 0) // 加法不需要请求正文，空记录表示输入结束
+                break;
+            n = calculate(has_query ? query : NULL, out, sizeof(out));
+            if (n >= (int)sizeof(out))
+                n = sizeof(out) - 1;
+            if (respond(fd, id, out, n) < 0 || !keep)
+                return;
+            break;
+        }
+    }
+}
+
+int main(void)
+{
+    int fd;
+
+    signal(SIGPIPE, SIG_IGN);
+    while (1) // 从服务器传入的监听套接字上依次接受连接
+    {
+        if ((fd = accept(FCGI_LISTENSOCK_FILENO, NULL, NULL)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            exit(1);
+        }
+        serve_conn(fd);
+        close(fd);
+    }
+}
+
+#endif /* FASTCGI */
@@ -523,6 +523,186 @@ void V(sem_t *sem)
         unix_error("V error");
 }
 
+/**********************************
+ * 线程池 - 固定数量的工作线程 + 有界任务队列
+ **********************************/
+
+/* threadpool_worker - 工作线程主循环：从队列头部取任务并执行 */
+static void *threadpool_worker(void *arg)
+{
+    threadpool_t *pool = (threadpool_t *)arg;
+    void (*func)(void *);
+    void *targ;
+    task_t *task;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0 && !pool->shutdown) // 队列为空时等待新任务
+            pthread_cond_wait(&pool->notify, &pool->lock);
+        if (pool->count == 0) // 已关闭且队列中任务已全部处理完
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        task = pool->head; // 取出队头任务
+        pool->head = task->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pool->count--;
+        func = task->func;
+        targ = task->arg;
+        task->next = pool->free; // 节点归还空闲链表
+        pool->free = task;
+        pthread_cond_signal(&pool->notfull); // 唤醒一个因队列已满而等待的提交者
+        pthread_mutex_unlock(&pool->lock);
+
+        func(targ); // 在锁外执行任务，任务自行负责参数的释放
+    }
+    return NULL;
+}
+
+/*
+ * threadpool_create - 创建包含thread_count个工作线程、最多容纳queue_size个
+ *    排队任务的线程池。stack_size为每个工作线程的栈大小（字节），为0时使用
+ *    系统默认值。失败时返回NULL。
+ */
+threadpool_t *threadpool_create(int thread_count, int queue_size, size_t stack_size)
+{
+    threadpool_t *pool;
+    pthread_attr_t attr;
+    int i;
+
+    if (thread_count <= 0 || queue_size <= 0)
+        return NULL;
+    if ((pool = calloc(1, sizeof(threadpool_t))) == NULL)
+        return NULL;
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    pool->nodes = calloc(queue_size, sizeof(task_t));
+    if (pool->threads == NULL || pool->nodes == NULL)
+    {
+        free(pool->threads);
+        free(pool->nodes);
+        free(pool);
+        return NULL;
+    }
+
+    pool->queue_size = queue_size;
+    for (i = 0; i < queue_size; i++) // 将预分配的节点串成空闲链表
+    {
+        pool->nodes[i].next = pool->free;
+        pool->free = &pool->nodes[i];
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->notify, NULL);
+    pthread_cond_init(&pool->notfull, NULL);
+
+    pthread_attr_init(&attr);
+    if (stack_size > 0)
+    {
+        if (stack_size < PTHREAD_STACK_MIN)
+            stack_size = PTHREAD_STACK_MIN;
+        pthread_attr_setstacksize(&attr, stack_size);
+    }
+    for (i = 0; i < thread_count; i++)
+    {
+        if (pthread_create(&pool->threads[i], &attr, threadpool_worker, pool) != 0)
+            break;
+        pool->thread_count++;
+    }
+    pthread_attr_destroy(&attr);
+
+    if (pool->thread_count < thread_count) // 部分线程创建失败，回收已创建的线程
+    {
+        threadpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*
+ * threadpool_add - 向线程池提交一个任务。队列已满时阻塞等待，
+ *    从而把压力反馈给调用者（例如accept循环）。线程池已关闭时返回-1。
+ */
+int threadpool_add(threadpool_t *pool, void (*func)(void *), void *arg)
+{
+    task_t *task;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == pool->queue_size && !pool->shutdown)
+        pthread_cond_wait(&pool->notfull, &pool->lock);
+    if (pool->shutdown)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+
+    task = pool->free; // 从空闲链表取一个节点
+    pool->free = task->next;
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+    if (pool->tail) // 追加到队尾
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->count++;
+
+    pthread_cond_signal(&pool->notify); // 唤醒一个空闲的工作线程
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/*
+ * threadpool_destroy - 关闭线程池：不再接受新任务，等待队列中剩余任务
+ *    执行完毕后回收全部工作线程并释放资源
+ */
+int threadpool_destroy(threadpool_t *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return -1;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->notify);
+    pthread_cond_broadcast(&pool->notfull);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->notify);
+    pthread_cond_destroy(&pool->notfull);
+    free(pool->threads);
+    free(pool->nodes);
+    free(pool);
+    return 0;
+}
+
+/*******************************
+ * Wrappers for thread pool
+ *******************************/
+
+threadpool_t *Threadpool_create(int thread_count, int queue_size, size_t stack_size)
+{
+    threadpool_t *pool;
+
+    if ((pool = threadpool_create(thread_count, queue_size, stack_size)) == NULL)
+        app_error("Threadpool_create error");
+    return pool;
+}
+
+void Threadpool_add(threadpool_t *pool, void (*func)(void *), void *arg)
+{
+    if (threadpool_add(pool, func, arg) < 0)
+        app_error("Threadpool_add error");
+}
+
 /****************************************
  * The Rio package - Robust I/O functions
  ****************************************/
@@ -550,6 +730,24 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
     return (n - nleft); /* Return >= 0 */
 }
 
+/*
+ * rio_wait - 非阻塞描述符返回EAGAIN时，最多等待RIO_TIMEOUT毫秒直到其
+ *    可读/可写。超时返回-1并置errno为ETIMEDOUT，避免慢客户端无限占用线程。
+ */
+int rio_wait(int fd, short events)
+{
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    while ((rc = poll(&pfd, 1, RIO_TIMEOUT)) < 0 && errno == EINTR)
+        ;
+    if (rc == 0)
+        errno = ETIMEDOUT;
+    return rc > 0 ? 0 : -1;
+}
+
 ssize_t rio_writen(int fd, const void *usrbuf, size_t n)
 {
     size_t nleft = n;          // 记录待写入数据的大小
@@ -562,6 +760,8 @@ ssize_t rio_writen(int fd, const void *usrbuf, size_t n)
         {
             if (errno == EINTR) // 如果被信号处理器打断，则继续写入
                 continue;
+            else if (errno == EAGAIN && rio_wait(fd, POLLOUT) == 0) // 非阻塞套接字的发送缓冲区已满，等待可写后继续
+                continue;
             else
                 return -1;
         }
@@ -572,24 +772,64 @@ ssize_t rio_writen(int fd, const void *usrbuf, size_t n)
 }
 
 /*
- * rio_read - This is a wrapper for the Unix read() function that
- *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
- *    buffer, where n is the number of bytes requested by the user and
- *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+ * rio_sendv - 用一次sendmsg系统调用把多个缓冲区发送到套接字，处理部分写入
+ *    与EAGAIN，直到全部写完。flags传给sendmsg，例如MSG_MORE表示后面还有
+ *    数据（如紧接着的sendfile），让内核合并成满长度的TCP报文段。
+ *    iov数组会被修改。成功返回写入的总字节数，出错返回-1。
  */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+ssize_t rio_sendv(int fd, struct iovec *iov, int iovcnt, int flags)
 {
-    int cnt; // 用于记录实际读取的字节数
+    ssize_t nwritten, total = 0;
+    struct msghdr msg;
 
+    memset(&msg, 0, sizeof(msg));
+    while (iovcnt > 0)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        if ((nwritten = sendmsg(fd, &msg, flags | MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN && rio_wait(fd, POLLOUT) == 0)
+                continue;
+            else
+                return -1;
+        }
+        total += nwritten;
+        while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) // 跳过已完整写出的缓冲区
+        {
+            nwritten -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) // 当前缓冲区只写出了一部分
+        {
+            iov->iov_base = (char *)iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return total;
+}
+
+/*
+ * rio_refill - 内部缓冲区为空时调用read重新填充，处理EINTR与非阻塞描述符上的EAGAIN。
+ *    返回缓冲区中的字节数，EOF返回0，出错返回-1。
+ */
+static ssize_t rio_refill(rio_t *rp)
+{
     while (rp->rio_cnt <= 0) // 如果内部缓冲区为空，则需要重新填充
     {
         rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf)); // read函数会从文件描述符rp->rio_fd指向的文件中读取数据，存储到rp->rio_buf指向的内部缓冲区中，并返回读取的字节数，以达到填充内部缓冲区效果
 
         if (rp->rio_cnt < 0) // 如果read函数返回值小于0，表示读取出错
         {
-            if (errno != EINTR) // 如果错误不是由信号中断引起的，则直接返回-1
+            if (errno == EAGAIN) // 非阻塞描述符暂无数据，等待可读后重试
+            {
+                if (rio_wait(rp->rio_fd, POLLIN) < 0)
+                    return -1;
+            }
+            else if (errno != EINTR) // 如果错误不是由信号中断引起的，则直接返回-1
                 return -1;
         }
         else if (rp->rio_cnt == 0) // 如果read函数返回0，表示已到达文件结尾，读取结束
@@ -597,6 +837,24 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
         else
             rp->rio_bufptr = rp->rio_buf; // 缓冲区填充成功，更新内部缓冲区的指针rp->rio_bufptr，将其指向缓冲区的开头
     }
+    return rp->rio_cnt;
+}
+
+/*
+ * rio_read - This is a wrapper for the Unix read() function that
+ *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ *    buffer, where n is the number of bytes requested by the user and
+ *    rio_cnt is the number of unread bytes in the internal buffer. On
+ *    entry, rio_read() refills the internal buffer via a call to
+ *    read() if the internal buffer is empty.
+ */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt; // 用于记录实际读取的字节数
+    ssize_t rc;
+
+    if ((rc = rio_refill(rp)) <= 0) // 内部缓冲区为空时重新填充
+        return rc;
 
     cnt = n;             // 需要读取的字节数初始化为n
     if (rp->rio_cnt < n) // 如果内部缓冲区剩余字节数小于需要读取的字节数n，只需将所有剩余字节读取到用户缓冲区中
@@ -614,6 +872,7 @@ void rio_readinitb(rio_t *rp, int fd)
 {
     rp->rio_fd = fd;
     rp->rio_cnt = 0;
+    rp->rio_eof = 0;
     rp->rio_bufptr = rp->rio_buf;
 }
 
@@ -638,35 +897,82 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     return (n - nleft); /* return >= 0 */
 }
 
+/*
+ * rio_readlineb - Robustly read a text line (buffered)
+ *    用memchr在内部缓冲区中成块查找换行符，整段复制到用户缓冲区，
+ *    每行只做一次扫描与一次复制，而不是逐字节调用rio_read。
+ *    最多读取maxlen-1个字节并以'\0'结尾，返回读取的字节数（含换行符），
+ *    未读到任何数据就遇到EOF时返回0，出错返回-1。
+ */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 {
-    int n, rc;              // n表示当前已经读取的字符数，rc用于存储每次调用rio_read时返回的值
-    char c, *bufp = usrbuf; // c用于暂存每次读取到的单个字符，bufp指向用户缓冲区中当前的位置
+    size_t n = 0, cnt;        // n表示当前已经读取的字符数
+    char *bufp = usrbuf, *nl; // bufp指向用户缓冲区中当前的位置，nl指向找到的换行符
+    ssize_t rc;
 
-    /* 循环读取每个字符 */
-    for (n = 1; n < maxlen; n++)
+    while (n + 1 < maxlen)
     {
-        if ((rc = rio_read(rp, &c, 1)) == 1) // 调用rio_read读取一个字符到c，返回结果保存在rc中
+        if ((rc = rio_refill(rp)) < 0) // 内部缓冲区为空时重新填充，出错返回-1
+            return -1;
+        if (rc == 0) // EOF：一个字符都没有读到时返回0，否则返回已读到的部分
         {
-            *bufp++ = c;   // 如果成功读取到一个字符，则将其存储在用户缓冲区中，并更新bufp的指向位置
-            if (c == '\n') // 如果当前字符是换行符，则说明已经读取完一行数据了
-            {
-                ++n;   // 将n加1，因为当前这个字符也被算作是已读取的字符之一
-                break; // 跳出循环，结束函数调用
-            }
+            if (n == 0)
+                return 0;
+            break;
         }
-        else if (rc == 0) // 如果返回值rc==0，表示没有读取到任何字符（EOF）
+        cnt = maxlen - 1 - n; // 本次最多复制的字节数
+        if ((size_t)rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL) // 换行符之后的数据留给下一次读取
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
+        if (nl) // 已读完一行
+            break;
+    }
+    *bufp = 0; // 在用户缓冲区的末尾加上字符串结束符 '\0'
+    return n;
+}
+
+/*
+ * rio_fillb - 非阻塞地把描述符上当前可读的数据全部读入内部缓冲区，
+ *    直到read返回EAGAIN或缓冲区已满。未读数据会先移到缓冲区开头。
+ *    返回缓冲区中未读的字节数；对端关闭（如半关闭写端）后仍先返回已缓冲的字节数，
+ *    并置rio_eof，缓冲区取空后才返回0。出错返回-1。
+ */
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t nread;
+    size_t room;
+
+    if (rp->rio_eof)
+        return rp->rio_cnt;
+    if (rp->rio_bufptr != rp->rio_buf) // 压缩缓冲区，为新数据腾出尾部空间
+    {
+        memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    while ((room = sizeof(rp->rio_buf) - rp->rio_cnt) > 0)
+    {
+        if ((nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, room)) < 0)
         {
-            if (n == 1) // 如果当前已读取的字符数为 1，则表示此次读取操作并未真正读取到任何数据，直接返回 0
-                return 0;
-            else // 如果已读取的字符数不为 1，则说明已经读取到了一些数据，现在已经读完了，正常退出循环
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) // 内核中的数据已读完
                 break;
-        }
-        else // 如果返回值小于 0 则表示出现了错误，返回 -1
             return -1;
+        }
+        else if (nread == 0) // EOF，已缓冲的完整请求仍须处理
+        {
+            rp->rio_eof = 1;
+            break;
+        }
+        rp->rio_cnt += nread;
     }
-    *bufp = 0;    // 在用户缓冲区的末尾加上字符串结束符 '\0'
-    return n - 1; // 返回读取到的字符数减去最后那个换行符（如果有的话）
+    return rp->rio_cnt;
 }
 
 /**********************************
@@ -764,7 +1070,11 @@ int open_clientfd(const char *hostname, const char *port)
         return clientfd;
 }
 
-int open_listenfd(const char *port)
+/*
+ * open_listenfd_opt - 与open_listenfd相同，reuseport非0时另外设置SO_REUSEPORT，
+ *    允许多个套接字监听同一端口，由内核在它们之间分配新连接。
+ */
+int open_listenfd_opt(const char *port, int reuseport)
 {
     struct addrinfo hints, *listp, *p;
     int listenfd, rc, optval = 1;
@@ -793,6 +1103,11 @@ int open_listenfd(const char *port)
 
         /* 设置SO_REUSEADDR选项解决“地址已经被使用”的错误 */
         Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval, sizeof(int));
+        if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (const void *)&optval, sizeof(int)) < 0)
+        {
+            close(listenfd);
+            continue;
+        }
 
         /* 绑定套接字描述符到地址 */
         if (Bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) // 将套接字与本地地址和端口进行绑定
@@ -818,6 +1133,11 @@ int open_listenfd(const char *port)
     return listenfd; // 返回监听套接字描述符
 }
 
+int open_listenfd(const char *port)
+{
+    return open_listenfd_opt(port, 0);
+}
+
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
@@ -838,4 +1158,13 @@ int Open_listenfd(const char *port)
     if ((rc = open_listenfd(port)) < 0)
         unix_error("Open_listenfd error");
     return rc;
+}
+
+int Open_listenfd_opt(const char *port, int reuseport)
+{
+    int rc;
+
+    if ((rc = open_listenfd_opt(port, reuseport)) < 0)
+        unix_error("Open_listenfd error");
+    return rc;
 }
\ No newline at end of file
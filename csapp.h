@@ -6,6 +6,8 @@
 #include <stdarg.h>     //可变参数函数
 #include <unistd.h>     //POSIX标准的Unix API的头文件
 #include <string.h>     // 字符串处理
+#include <stdint.h>     // 定长整数类型
+#include <limits.h>     // 各类型取值范围
 #include <ctype.h>      // 字符分类和转换
 #include <setjmp.h>     // 非局部跳转
 #include <signal.h>     // 信号处理
@@ -16,11 +18,14 @@
 #include <sys/stat.h>   // 文件状态
 #include <fcntl.h>      // 文件控制
 #include <sys/mman.h>   // 内存管理
+#include <sys/uio.h>    // 分散/聚集I/O
 #include <errno.h>      // 错误码
 #include <math.h>       // 数学函数
 #include <pthread.h>    // 多线程
 #include <semaphore.h>  // 信号量
 #include <sys/socket.h> // Socket编程
+#include <sys/epoll.h>  // epoll事件通知
+#include <poll.h>       // 单描述符等待
 #include <netdb.h>      // 网络相关
 #include <netinet/in.h> // IP地址相关
 #include <arpa/inet.h>  // 网络相关
@@ -35,12 +40,14 @@
 #define MAXLINE 8192     // 文本行最大长度
 #define MAXBUF 8192      // I/O缓存区最大长度
 #define LISTENQ 1024     // listen函数第二个参数的最大值，设定请求队列的最大长度
+#define RIO_TIMEOUT 30000 // 非阻塞描述符上Rio读写的最长等待时间（毫秒）
 
 typedef struct sockaddr SA; // 自定义结构体名SA代替struct sockaddr
 typedef struct              // 自定义结构体rio_t，提供Robust I/O操作
 {
     int rio_fd;                // 描述符
     int rio_cnt;               // 当前未读取的字节数
+    int rio_eof;               // rio_fillb已读到EOF，对端不会再发送数据
     char *rio_bufptr;          // 下一个待读取的字符位置
     char rio_buf[RIO_BUFSIZE]; // 存放缓冲区数据
 } rio_t;
@@ -56,13 +63,18 @@ typedef struct task
 /* 定义线程池结构体 */
 typedef struct threadpool
 {
-    int thread_count;      // 线程数量
-    pthread_t *threads;    // 线程数组首地址
-    task_t *head;          // 指向任务队列的头指针
-    task_t *tail;          // 指向任务队列的尾指针
-    pthread_mutex_t lock;  // 互斥锁，用于访问任务队列
-    pthread_cond_t notify; // 条件变量，用于通知工作线程有新的任务
-    int shutdown;          // 是否关闭线程池
+    int thread_count;       // 线程数量
+    pthread_t *threads;     // 线程数组首地址
+    task_t *head;           // 指向任务队列的头指针
+    task_t *tail;           // 指向任务队列的尾指针
+    task_t *free;           // 空闲任务节点链表，节点在创建时一次性分配
+    task_t *nodes;          // 预分配的任务节点数组首地址
+    int queue_size;         // 任务队列容量上限
+    int count;              // 当前排队中的任务数
+    pthread_mutex_t lock;   // 互斥锁，用于访问任务队列
+    pthread_cond_t notify;  // 条件变量，用于通知工作线程有新的任务
+    pthread_cond_t notfull; // 条件变量，用于通知提交者任务队列有空位
+    int shutdown;           // 是否关闭线程池
 } threadpool_t;
 
 extern int h_errno;    // DNS错误的全局变量
@@ -149,6 +161,7 @@ int Setsockopt(int s, int level, int optname, const void *optval, int optlen);
 int Bind(int sockfd, struct sockaddr *my_addr, int addrlen);
 int Listen(int s, int backlog);
 int Accept(int s, struct sockaddr *addr, socklen_t *addrlen);
+int accept_nonblock(int s, struct sockaddr *addr, socklen_t *addrlen); // linux_io.c
 int Connect(int sockfd, struct sockaddr *serv_addr, int addrlen);
 
 /* Protocol independent wrappers */
@@ -170,18 +183,32 @@ void Pthread_detach(pthread_t tid);
 void Pthread_exit(void *retval);
 pthread_t Pthread_self(void);
 void Pthread_once(pthread_once_t *once_control, void (*init_function)());
+int thread_pin(int n); // linux_io.c
 
 /* POSIX semaphore wrappers */
 void Sem_init(sem_t *sem, int pshared, unsigned int value);
 void P(sem_t *sem);
 void V(sem_t *sem);
 
+/* 线程池 */
+threadpool_t *threadpool_create(int thread_count, int queue_size, size_t stack_size);
+int threadpool_add(threadpool_t *pool, void (*func)(void *), void *arg);
+int threadpool_destroy(threadpool_t *pool);
+
+/* 线程池函数封装 */
+threadpool_t *Threadpool_create(int thread_count, int queue_size, size_t stack_size);
+void Threadpool_add(threadpool_t *pool, void (*func)(void *), void *arg);
+
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, const void *usrbuf, size_t n);
+ssize_t rio_sendv(int fd, struct iovec *iov, int iovcnt, int flags);
+ssize_t rio_sendfile(int out_fd, int in_fd, off_t offset, size_t count); // linux_io.c
+int rio_wait(int fd, short events);
 void rio_readinitb(rio_t *rp, int fd);
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_fillb(rio_t *rp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -193,9 +220,11 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(const char *hostname, const char *port);
 int open_listenfd(const char *port);
+int open_listenfd_opt(const char *port, int reuseport);
 
 /* Wrappers for reentrant protocol-independent client/server helpers */
 int Open_clientfd(const char *hostname, const char *port);
 int Open_listenfd(const char *port);
+int Open_listenfd_opt(const char *port, int reuseport);
 
 #endif /* __CSAPP_H__ */
\ No newline at end of file
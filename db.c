@@ -0,0 +1,126 @@
+#include "sever.h"
+
+/*
+ * 用户数据库连接池：每个工作线程持有一个长期打开的连接（线程特定数据），
+ * 第一次使用时打开并设置WAL等参数，线程退出时关闭。每个连接缓存编译好的
+ * 语句，请求之间只需重置并重新绑定参数，省去打开数据库和编译SQL的开销。
+ * 连接只被所属线程使用，因此无需加锁。
+ */
+
+/* 与db_stmt_id_t一一对应 */
+static const char *stmt_sql[DB_NSTMTS] = {
+    "SELECT 1 FROM users WHERE username=? AND password=?;",            // DB_LOGIN
+    "SELECT 1 FROM users WHERE username=?;",                           // DB_USER_EXISTS
+    "INSERT INTO users (username, password, email) VALUES (?, ?, ?);", // DB_USER_INSERT
+};
+
+/* 连接打开时执行的参数设置 */
+static const char db_pragmas[] =
+    "PRAGMA journal_mode=WAL;"    // 读写互不阻塞，多个工作线程可同时查询
+    "PRAGMA synchronous=NORMAL;"  // WAL模式下只在检查点时同步磁盘
+    "PRAGMA mmap_size=268435456;" // 通过内存映射读取数据库文件，最多256MB
+    "PRAGMA temp_store=MEMORY;"
+    "PRAGMA cache_size=-8192;";   // 每个连接8MB页缓存
+
+struct db
+{
+    sqlite3 *conn;                  // 数据库连接
+    sqlite3_stmt *stmts[DB_NSTMTS]; // 按需编译的语句缓存
+};
+
+static pthread_key_t db_key;
+static pthread_once_t db_once = PTHREAD_ONCE_INIT;
+
+/* 线程退出时释放该线程的连接 */
+static void db_destroy(void *arg)
+{
+    db_t *db = arg;
+    int i;
+
+    for (i = 0; i < DB_NSTMTS; i++)
+        sqlite3_finalize(db->stmts[i]);
+    sqlite3_close(db->conn);
+    free(db);
+}
+
+static void db_key_init(void)
+{
+    pthread_key_create(&db_key, db_destroy);
+}
+
+/*
+ * db_get - 返回调用线程的数据库连接，第一次调用时打开。
+ *    打开失败返回NULL，下次调用时重试。
+ */
+db_t *db_get(void)
+{
+    db_t *db;
+    char *errmsg = NULL;
+
+    pthread_once(&db_once, db_key_init);
+    if ((db = pthread_getspecific(db_key)) != NULL)
+        return db;
+
+    db = Calloc(1, sizeof(db_t));
+    if (sqlite3_open_v2(DB_PATH, &db->conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+    {
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db->conn));
+        sqlite3_close(db->conn);
+        free(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db->conn, DB_BUSY_TIMEOUT); // 其他线程写入时等待，而不是立即返回SQLITE_BUSY
+    if (sqlite3_exec(db->conn, db_pragmas, NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        fprintf(stderr, "Cannot configure database: %s\n", errmsg); // 参数设置失败不影响使用
+        sqlite3_free(errmsg);
+    }
+    pthread_setspecific(db_key, db);
+    return db;
+}
+
+/*
+ * db_stmt - 取出编号为id的缓存语句，第一次使用时编译。
+ *    返回的语句已重置并清除了上次的参数，失败返回NULL。
+ */
+sqlite3_stmt *db_stmt(db_t *db, db_stmt_id_t id)
+{
+    sqlite3_stmt *stmt = db->stmts[id];
+
+    if (stmt == NULL)
+    {
+        if (sqlite3_prepare_v3(db->conn, stmt_sql[id], -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK)
+        {
+            fprintf(stderr, "无法编译 SQL 语句: %s\n", sqlite3_errmsg(db->conn));
+            return NULL;
+        }
+        db->stmts[id] = stmt;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return stmt;
+}
+
+/*
+ * db_step - 执行一次语句后立即重置，释放读事务/写锁，
+ *    避免语句停留在执行中的状态阻塞WAL检查点。返回sqlite3_step的结果。
+ *    耗时计入SQLite的运行指标。
+ */
+int db_step(sqlite3_stmt *stmt)
+{
+    struct timespec t0, t1;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    metrics_sqlite((t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000);
+    return rc;
+}
+
+/* db_errmsg - 连接上最近一次错误的描述 */
+const char *db_errmsg(db_t *db)
+{
+    return sqlite3_errmsg(db->conn);
+}
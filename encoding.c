@@ -0,0 +1,130 @@
+#include "sever.h"
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * 内容编码：解析Accept-Encoding，并为可压缩的静态文件生成压缩版本。
+ * 压缩版本在文件首次放入缓存时生成，与原始内容一起保存在缓存条目中。
+ * zstd为可选项，编译时定义HAVE_ZSTD并链接-lzstd后启用。
+ */
+
+#define GZIP_LEVEL 9 // 每个文件只压缩一次，使用最高压缩级别
+#define ZSTD_LEVEL 19
+
+static const char *enc_names[ENC_COUNT] = {
+    "identity",
+    "gzip",
+#ifdef HAVE_ZSTD
+    "zstd",
+#endif
+};
+
+/* encoding_name - 编码在Content-Encoding中的名称 */
+const char *encoding_name(int enc)
+{
+    return enc_names[enc];
+}
+
+/* 比较长度为len的编码名与name，忽略大小写 */
+static int token_is(const char *tok, size_t len, const char *name)
+{
+    return strlen(name) == len && !strncasecmp(tok, name, len);
+}
+
+/*
+ * encoding_parse - 解析Accept-Encoding头部的值，返回客户端可接受的编码集合
+ *    （以1 << ENC_xxx为位）。q=0表示拒绝该编码；identity总是可接受。
+ */
+int encoding_parse(const char *value)
+{
+    const char *p = value, *tok, *end, *q;
+    size_t len;
+    int mask = 1 << ENC_IDENTITY, enc;
+
+    for (; *(p += strspn(p, " \t,")) && *p != '\r' && *p != '\n'; p = end) // 逐个处理逗号分隔的编码项
+    {
+        tok = p;
+        len = strcspn(tok, " \t,;\r\n");
+        end = tok + strcspn(tok, ",\r\n");
+        if ((q = memchr(tok, ';', end - tok)) != NULL && (q = memchr(q, '=', end - q)) != NULL && atof(q + 1) <= 0)
+            continue; // q=0
+        if (token_is(tok, len, "*"))
+            return (1 << ENC_COUNT) - 1;
+        for (enc = ENC_IDENTITY + 1; enc < ENC_COUNT; enc++)
+            if (token_is(tok, len, enc_names[enc]) || (enc == ENC_GZIP && token_is(tok, len, "x-gzip")))
+                mask |= 1 << enc;
+    }
+    return mask;
+}
+
+/* encoding_compressible - 该MIME类型是否值得压缩（图片等已压缩过的格式不处理） */
+int encoding_compressible(const char *filetype)
+{
+    return !strncmp(filetype, "text/", 5);
+}
+
+/* 以gzip格式压缩，成功返回压缩后的长度，失败返回-1 */
+static ssize_t gzip_compress(const char *in, size_t len, char **out)
+{
+    z_stream zs;
+    size_t bound;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) // windowBits加16输出gzip头尾
+        return -1;
+    bound = deflateBound(&zs, len);
+    *out = Malloc(bound);
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)*out;
+    zs.avail_out = bound;
+    rc = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END)
+    {
+        free(*out);
+        return -1;
+    }
+    return bound - zs.avail_out;
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t zstd_compress(const char *in, size_t len, char **out)
+{
+    size_t bound = ZSTD_compressBound(len), n;
+
+    *out = Malloc(bound);
+    n = ZSTD_compress(*out, bound, in, len, ZSTD_LEVEL);
+    if (ZSTD_isError(n))
+    {
+        free(*out);
+        return -1;
+    }
+    return n;
+}
+#endif
+
+/*
+ * encoding_compress - 用编码enc压缩in，结果由*out返回，调用者负责free。
+ *    压缩失败或压缩后没有变小时返回-1，此时*out无需释放。
+ */
+ssize_t encoding_compress(int enc, const char *in, size_t len, char **out)
+{
+    ssize_t n = -1;
+
+    if (enc == ENC_GZIP)
+        n = gzip_compress(in, len, out);
+#ifdef HAVE_ZSTD
+    else if (enc == ENC_ZSTD)
+        n = zstd_compress(in, len, out);
+#endif
+    if (n >= 0 && (size_t)n >= len)
+    {
+        free(*out);
+        n = -1;
+    }
+    return n;
+}
@@ -0,0 +1,73 @@
+#ifndef __FASTCGI_H__
+#define __FASTCGI_H__
+
+/*
+ * FastCGI 1.0协议的记录格式与常量，服务器端（fcgi.c）与应用程序端
+ * （calculate/add.c的FastCGI模式）共用。
+ */
+
+#define FCGI_LISTENSOCK_FILENO 0 // 应用程序进程从描述符0上accept服务器的连接
+#define FCGI_VERSION_1 1
+#define FCGI_HEADER_LEN 8
+#define FCGI_MAX_CONTENT 65535 // 单个记录正文的最大长度
+
+/* 记录类型 */
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+
+#define FCGI_RESPONDER 1        // 角色
+#define FCGI_KEEP_CONN 1        // BEGIN_REQUEST标志：请求结束后应用程序不关闭连接
+#define FCGI_REQUEST_COMPLETE 0 // END_REQUEST的协议状态
+
+/* 记录头部 */
+typedef struct
+{
+    unsigned char version;
+    unsigned char type;
+    unsigned char requestIdB1;
+    unsigned char requestIdB0;
+    unsigned char contentLengthB1;
+    unsigned char contentLengthB0;
+    unsigned char paddingLength;
+    unsigned char reserved;
+} FCGI_Header;
+
+/* BEGIN_REQUEST记录的正文 */
+typedef struct
+{
+    unsigned char roleB1;
+    unsigned char roleB0;
+    unsigned char flags;
+    unsigned char reserved[5];
+} FCGI_BeginRequestBody;
+
+/* END_REQUEST记录的正文 */
+typedef struct
+{
+    unsigned char appStatusB3;
+    unsigned char appStatusB2;
+    unsigned char appStatusB1;
+    unsigned char appStatusB0;
+    unsigned char protocolStatus;
+    unsigned char reserved[3];
+} FCGI_EndRequestBody;
+
+/* 填写记录头部 */
+static inline void fcgi_header(FCGI_Header *h, int type, int id, int len)
+{
+    h->version = FCGI_VERSION_1;
+    h->type = type;
+    h->requestIdB1 = (id >> 8) & 0xff;
+    h->requestIdB0 = id & 0xff;
+    h->contentLengthB1 = (len >> 8) & 0xff;
+    h->contentLengthB0 = len & 0xff;
+    h->paddingLength = 0;
+    h->reserved = 0;
+}
+
+#endif /* __FASTCGI_H__ */
@@ -0,0 +1,419 @@
+#include "sever.h"
+#include "fastcgi.h"
+#include <sys/un.h>
+#include <sys/prctl.h>
+
+/*
+ * FastCGI客户端：每个上游程序在启动时派生若干常驻进程，共享一个Unix域监听
+ * 套接字（作为进程的描述符0）。服务器与上游之间保持长连接（FCGI_KEEP_CONN），
+ * 连接数不超过进程数：空闲连接放在连接池中复用，全部占用时工作线程等待。
+ * 上游的输出随读随发，HTTP/1.1客户端以分块传输方式接收，不必等程序结束。
+ * 监控线程每秒检查一次上游进程，退出的进程会被重新派生。
+ */
+
+#define FCGI_MAX_UPSTREAMS 8 // 最多可配置的上游程序数
+#define FCGI_TIMEOUT 30      // 与上游通信的超时时间（秒）
+#define FCGI_REQUEST_ID 1    // 每个连接同一时刻只有一个请求
+
+/* 到上游的一个连接 */
+typedef struct fcgi_conn
+{
+    int fd;
+    struct fcgi_conn *next; // 连接池中的链接
+} fcgi_conn_t;
+
+/* 一个上游程序 */
+typedef struct
+{
+    const char *route;     // 交给该程序处理的路由模式（可含:param与*）
+    char *program;         // 程序路径
+    char sockpath[108];    // 监听套接字的路径（sun_path的长度）
+    int listenfd;          // 上游进程共享的监听套接字
+    pid_t *pids;           // 上游进程
+    pthread_mutex_t lock;
+    pthread_cond_t avail;  // 有连接归还或可以新建连接
+    fcgi_conn_t *idle;     // 空闲连接
+    int nconns;            // 已建立的连接数（含使用中的）
+} fcgi_upstream_t;
+
+static fcgi_upstream_t upstreams[FCGI_MAX_UPSTREAMS];
+static int nupstreams;
+
+/*
+ * fcgi_add - 登记一个上游程序，spec的格式为"路由=程序路径"，
+ *    如"/calculate/add=./calculate/add_fcgi"。格式错误或数量超限时返回-1。
+ */
+int fcgi_add(const char *spec)
+{
+    fcgi_upstream_t *up;
+    const char *eq = strchr(spec, '=');
+
+    if (eq == NULL || eq == spec || spec[0] != '/' || eq[1] == '\0' || nupstreams == FCGI_MAX_UPSTREAMS)
+        return -1;
+    up = &upstreams[nupstreams++];
+    up->route = strndup(spec, eq - spec);
+    up->program = strdup(eq + 1);
+    return 0;
+}
+
+/* 派生一个上游进程，监听套接字作为其描述符0 */
+static pid_t fcgi_spawn(fcgi_upstream_t *up)
+{
+    char *argv[] = {up->program, NULL};
+    pid_t pid;
+
+    if ((pid = fork()) == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);           // 服务器意外退出时上游进程随之退出
+        dup2(up->listenfd, FCGI_LISTENSOCK_FILENO); // dup2得到的描述符不带FD_CLOEXEC
+        execve(up->program, argv, environ);
+        fprintf(stderr, "fastcgi: cannot run %s: %s\n", up->program, strerror(errno));
+        _exit(127);
+    }
+    if (pid < 0)
+        fprintf(stderr, "fastcgi: fork error: %s\n", strerror(errno));
+    return pid;
+}
+
+/* 监控线程：重新派生已退出的上游进程 */
+static void *fcgi_monitor(void *arg)
+{
+    int i, j;
+
+    for (;;)
+    {
+        sleep(1);
+        for (i = 0; i < nupstreams; i++)
+            for (j = 0; j < config.fcgi_procs; j++)
+                if (upstreams[i].pids[j] <= 0 || waitpid(upstreams[i].pids[j], NULL, WNOHANG) > 0)
+                    upstreams[i].pids[j] = fcgi_spawn(&upstreams[i]);
+    }
+    return NULL;
+}
+
+/* 进程退出时结束上游进程并删除套接字文件 */
+static void fcgi_cleanup(void)
+{
+    int i, j;
+
+    for (i = 0; i < nupstreams; i++)
+    {
+        for (j = 0; j < config.fcgi_procs; j++)
+            if (upstreams[i].pids[j] > 0)
+                kill(upstreams[i].pids[j], SIGTERM);
+        unlink(upstreams[i].sockpath);
+    }
+}
+
+static void fcgi_handler(request_t *rq, const char *query, response_t *resp);
+
+/*
+ * fcgi_init - 为每个登记的上游程序创建监听套接字、派生config.fcgi_procs个进程，
+ *    并把其路由注册为进程内处理程序（覆盖同一路由的内置处理程序）。
+ */
+void fcgi_init(void)
+{
+    struct sockaddr_un addr;
+    fcgi_upstream_t *up;
+    pthread_t tid;
+    int i, j;
+
+    if (nupstreams == 0)
+        return;
+    for (i = 0; i < nupstreams; i++)
+    {
+        up = &upstreams[i];
+        snprintf(up->sockpath, sizeof(up->sockpath), "/tmp/sever-fcgi.%d.%d", (int)getpid(), i);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, up->sockpath);
+        unlink(up->sockpath);
+        if ((up->listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            unix_error("fastcgi socket error");
+        if (bind(up->listenfd, (SA *)&addr, sizeof(addr)) < 0 || listen(up->listenfd, LISTENQ) < 0)
+            unix_error("fastcgi bind error");
+        fcntl(up->listenfd, F_SETFD, FD_CLOEXEC); // 不泄漏给CGI子进程
+
+        pthread_mutex_init(&up->lock, NULL);
+        pthread_cond_init(&up->avail, NULL);
+        up->pids = Calloc(config.fcgi_procs, sizeof(pid_t));
+        for (j = 0; j < config.fcgi_procs; j++)
+            up->pids[j] = fcgi_spawn(up);
+        if (route_add(ROUTE_GET, up->route, fcgi_handler) < 0)
+            app_error("fastcgi: bad route");
+    }
+    atexit(fcgi_cleanup);
+    Pthread_create(&tid, NULL, fcgi_monitor, NULL);
+    Pthread_detach(tid);
+}
+
+/* 从连接池取一个连接，没有空闲连接且连接数已达进程数时等待；连接失败返回NULL */
+static fcgi_conn_t *fcgi_get(fcgi_upstream_t *up, int *reused)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = {FCGI_TIMEOUT, 0};
+    fcgi_conn_t *c;
+    int fd;
+
+    pthread_mutex_lock(&up->lock);
+    while (up->idle == NULL && up->nconns >= config.fcgi_procs) // 每个上游进程同一时刻只服务一个连接
+        pthread_cond_wait(&up->avail, &up->lock);
+    if ((c = up->idle) != NULL)
+    {
+        up->idle = c->next;
+        pthread_mutex_unlock(&up->lock);
+        *reused = 1;
+        return c;
+    }
+    up->nconns++;
+    pthread_mutex_unlock(&up->lock);
+
+    *reused = 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, up->sockpath);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (SA *)&addr, sizeof(addr)) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        pthread_mutex_lock(&up->lock);
+        up->nconns--;
+        pthread_cond_signal(&up->avail);
+        pthread_mutex_unlock(&up->lock);
+        return NULL;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // 上游进程卡住时不会无限期占用工作线程
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    c = Malloc(sizeof(fcgi_conn_t));
+    c->fd = fd;
+    return c;
+}
+
+/* 归还连接；连接状态不确定时（出错、请求未完整结束）关闭而不复用 */
+static void fcgi_put(fcgi_upstream_t *up, fcgi_conn_t *c, int reuse)
+{
+    if (!reuse)
+    {
+        close(c->fd);
+        free(c);
+    }
+    pthread_mutex_lock(&up->lock);
+    if (reuse)
+    {
+        c->next = up->idle;
+        up->idle = c;
+    }
+    else
+        up->nconns--;
+    pthread_cond_signal(&up->avail);
+    pthread_mutex_unlock(&up->lock);
+}
+
+/* 以FastCGI名值对格式追加一个参数，空间不足时返回-1 */
+static int fcgi_param(unsigned char *buf, size_t *len, size_t size, const char *name, const char *value)
+{
+    size_t nlen = strlen(name), vlen = strlen(value), lens[2] = {nlen, vlen};
+    unsigned char *p = buf + *len;
+    int i;
+
+    if (*len + nlen + vlen + 8 > size)
+        return -1;
+    for (i = 0; i < 2; i++)
+        if (lens[i] < 128) // 长度小于128时用1字节，否则用最高位置1的4字节
+            *p++ = lens[i];
+        else
+        {
+            *p++ = (lens[i] >> 24) | 0x80;
+            *p++ = lens[i] >> 16;
+            *p++ = lens[i] >> 8;
+            *p++ = lens[i];
+        }
+    memcpy(p, name, nlen);
+    memcpy(p + nlen, value, vlen);
+    *len = p + nlen + vlen - buf;
+    return 0;
+}
+
+/* 以CGI变量形式传给应用程序的请求头部 */
+static const struct
+{
+    hdr_id_t id;
+    const char *name;
+} hdr_params[] = {
+    {HDR_HOST, "HTTP_HOST"},
+    {HDR_COOKIE, "HTTP_COOKIE"},
+    {HDR_ACCEPT_ENCODING, "HTTP_ACCEPT_ENCODING"},
+};
+
+/* 发送一个GET请求：BEGIN_REQUEST、参数、空PARAMS与空STDIN记录一次写出 */
+static int fcgi_send_request(int fd, fcgi_upstream_t *up, request_t *rq, const char *query)
+{
+    unsigned char buf[MAXBUF];
+    const char *value;
+    int i;
+    size_t len = 2 * FCGI_HEADER_LEN + sizeof(FCGI_BeginRequestBody), plen;
+    FCGI_BeginRequestBody *begin = (FCGI_BeginRequestBody *)(buf + FCGI_HEADER_LEN);
+
+    fcgi_header((FCGI_Header *)buf, FCGI_BEGIN_REQUEST, FCGI_REQUEST_ID, sizeof(*begin));
+    memset(begin, 0, sizeof(*begin));
+    begin->roleB0 = FCGI_RESPONDER;
+    begin->flags = FCGI_KEEP_CONN;
+
+    if (fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "QUERY_STRING", query) < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "REQUEST_METHOD", "GET") < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "SCRIPT_NAME", up->route) < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "SCRIPT_FILENAME", up->program) < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "SERVER_PROTOCOL", rq->http11 ? "HTTP/1.1" : "HTTP/1.0") < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "GATEWAY_INTERFACE", "CGI/1.1") < 0 ||
+        fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, "SERVER_SOFTWARE", "Book Web Server") < 0)
+        return -1;
+    for (i = 0; i < (int)(sizeof(hdr_params) / sizeof(hdr_params[0])); i++) // 应用程序需要的请求头部
+        if ((value = http_header(rq->hdrs, hdr_params[i].id)) != NULL &&
+            fcgi_param(buf, &len, sizeof(buf) - 2 * FCGI_HEADER_LEN, hdr_params[i].name, value) < 0)
+            return -1;
+    plen = len - (2 * FCGI_HEADER_LEN + sizeof(*begin));
+    if (plen > FCGI_MAX_CONTENT)
+        return -1;
+    fcgi_header((FCGI_Header *)(buf + FCGI_HEADER_LEN + sizeof(*begin)), FCGI_PARAMS, FCGI_REQUEST_ID, plen);
+    fcgi_header((FCGI_Header *)(buf + len), FCGI_PARAMS, FCGI_REQUEST_ID, 0);
+    fcgi_header((FCGI_Header *)(buf + len + FCGI_HEADER_LEN), FCGI_STDIN, FCGI_REQUEST_ID, 0);
+    len += 2 * FCGI_HEADER_LEN;
+    return rio_writen(fd, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+/* 在已收到的输出中查找头部结束的空行，返回正文之前的字节数，未找到返回0 */
+static size_t cgi_header_end(const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+
+    while ((p = memchr(p, '\n', end - p)) != NULL && ++p < end)
+        if (*p == '\n')
+            return p + 1 - buf;
+        else if (*p == '\r' && p + 1 < end && p[1] == '\n')
+            return p + 2 - buf;
+    return 0;
+}
+
+/*
+ * 读取上游的响应记录并转发给客户端。返回1表示请求完整结束（连接可复用），
+ * 0表示上游在发出任何记录前就断开（尚未响应客户端，可以换一个连接重试），
+ * -1表示出错（已向客户端发出错误响应或关闭连接）。
+ */
+static int fcgi_relay(int fd, request_t *rq)
+{
+    FCGI_Header h;
+    FCGI_EndRequestBody *end;
+    response_t resp;
+    char *out, *body, *rec;
+    size_t outlen = 0, outsize = MAXBUF; // 尚未发出的输出
+    int len, pad, streaming = 0, done = 0, nrec = 0, overflow = 0;
+
+    out = Malloc(outsize);
+    rec = Malloc(FCGI_MAX_CONTENT + 255); // 正文加填充的最大长度
+
+    while (!done)
+    {
+        if (rio_readn(fd, &h, sizeof(h)) != sizeof(h))
+            break;
+        len = (h.contentLengthB1 << 8) | h.contentLengthB0;
+        pad = h.paddingLength;
+        if (rio_readn(fd, rec, len + pad) != len + pad)
+            break;
+        nrec++;
+        if (((h.requestIdB1 << 8) | h.requestIdB0) != FCGI_REQUEST_ID)
+            continue; // 不属于本请求的记录
+        switch (h.type)
+        {
+        case FCGI_STDOUT:
+            if (streaming) // 头部已发出，正文直接作为一块转发
+            {
+                resp_stream_write(&resp, rec, len);
+                break;
+            }
+            if (overflow || outlen + len > CGI_MAXOUT) // 输出过大，读完剩余记录后应答错误
+            {
+                overflow = 1;
+                break;
+            }
+            if (outlen + len > outsize)
+                out = Realloc(out, outsize = (outlen + len) * 2);
+            memcpy(out + outlen, rec, len);
+            outlen += len;
+            if (rq->http11 && cgi_header_end(out, outlen) > 0) // 头部完整，开始分块发送
+            {
+                body = cgi_headers(&resp, rq, out, outlen);
+                resp_stream_begin(&resp);
+                resp_stream_write(&resp, body, out + outlen - body);
+                streaming = 1;
+            }
+            break;
+        case FCGI_STDERR:
+            fprintf(stderr, "fastcgi: %.*s", len, rec);
+            break;
+        case FCGI_END_REQUEST:
+            end = (FCGI_EndRequestBody *)rec;
+            done = len >= (int)sizeof(*end) && end->protocolStatus == FCGI_REQUEST_COMPLETE ? 1 : -1;
+            break;
+        }
+    }
+    free(rec);
+
+    if (streaming)
+    {
+        if (done == 1)
+            resp_stream_end(&resp);
+        else
+            rq->keepalive = 0; // 分块传输已无法正常结束，关闭连接让客户端知道响应不完整
+    }
+    else if (done == 1 && overflow) // 不能把截断的输出当作完整的响应发出
+    {
+        rq->keepalive = 0;
+        clienterror(rq, rq->path, "502", "Bad Gateway", "The FastCGI application's output is too large");
+    }
+    else if (done == 1) // 上游输出已全部收到，作为普通响应发送
+    {
+        body = cgi_headers(&resp, rq, out, outlen);
+        resp_body(&resp, body, out + outlen - body);
+        resp_send(&resp);
+    }
+    else if (nrec > 0)
+        clienterror(rq, rq->path, "502", "Bad Gateway", "The FastCGI application failed");
+    free(out);
+    if (done == 0 && nrec == 0)
+        return 0;
+    return done == 1 ? 1 : -1;
+}
+
+/* 进程内处理程序：按匹配的路由（而非请求路径，以支持参数与前缀路由）把请求转给上游程序 */
+static void fcgi_handler(request_t *rq, const char *query, response_t *resp)
+{
+    const char *pattern = route_pattern(rq->params.route);
+    fcgi_upstream_t *up = NULL;
+    fcgi_conn_t *c;
+    int i, rc = 0, reused; // 一次也没能连上上游时同样应答502
+
+    for (i = 0; i < nupstreams && pattern; i++)
+        if (!strcmp(upstreams[i].route, pattern))
+            up = &upstreams[i];
+    resp->sent = 1; // 响应由fcgi_relay或clienterror发出
+    if (up == NULL)
+    {
+        clienterror(rq, rq->path, "502", "Bad Gateway", "Book sever couldn't find the FastCGI application");
+        return;
+    }
+
+    do
+    {
+        if ((c = fcgi_get(up, &reused)) == NULL)
+            break;
+        if (fcgi_send_request(c->fd, up, rq, query) < 0)
+            rc = 0;
+        else
+            rc = fcgi_relay(c->fd, rq);
+        fcgi_put(up, c, rc == 1);
+    } while (rc == 0 && reused); // 连接池中的连接可能已被上游关闭，换新连接重试
+
+    if (rc == 0)
+        clienterror(rq, rq->path, "502", "Bad Gateway", "Book sever couldn't reach the FastCGI application");
+}
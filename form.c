@@ -0,0 +1,154 @@
+#include "sever.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * URL编码的解码：application/x-www-form-urlencoded表单与查询串一趟扫描完成
+ * 字段切分以及%XX、'+'的解码，结果写入请求内存池，输入本身不被修改。
+ * 不含特殊字符的片段用SSE2每次检查16字节后整段复制。parse_uri用同一套扫描
+ * 解码请求路径。
+ */
+
+static int hexval(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* 返回[p, end)中第一个'&'、'='、'%'或'+'的位置，没有时返回end */
+static const char *scan_special(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i amp = _mm_set1_epi8('&'), eq = _mm_set1_epi8('=');
+    const __m128i pct = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+    __m128i x, hit;
+    int mask;
+
+    while (end - p >= 16)
+    {
+        x = _mm_loadu_si128((const __m128i *)p);
+        hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, amp), _mm_cmpeq_epi8(x, eq)),
+                           _mm_or_si128(_mm_cmpeq_epi8(x, pct), _mm_cmpeq_epi8(x, plus)));
+        if ((mask = _mm_movemask_epi8(hit)) != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '&' && *p != '=' && *p != '%' && *p != '+')
+        p++;
+    return p;
+}
+
+/* 解码s处的%XX写入*out，返回消耗的输入字节数；不是合法的转义时原样保留'%' */
+static int decode_pct(const char *s, const char *end, char *out)
+{
+    int hi, lo;
+
+    if (end - s >= 3 && (hi = hexval((unsigned char)s[1])) >= 0 && (lo = hexval((unsigned char)s[2])) >= 0)
+    {
+        *out = (char)(hi << 4 | lo);
+        return 3;
+    }
+    *out = '%';
+    return 1;
+}
+
+/*
+ * url_decode - 把src的len字节中的%XX解码后写入dst（至少len+1字节），
+ *    结果以'\0'结尾，返回解码后的长度（可能含有解码出的'\0'）。'+'保持不变。
+ */
+size_t url_decode(char *dst, const char *src, size_t len)
+{
+    const char *end = src + len, *q;
+    char *out = dst;
+
+    while (src < end)
+    {
+        q = scan_special(src, end);
+        memcpy(out, src, q - src);
+        out += q - src;
+        if ((src = q) == end)
+            break;
+        if (*src == '%')
+            src += decode_pct(src, end, out++);
+        else
+            *out++ = *src++;
+    }
+    *out = '\0';
+    return out - dst;
+}
+
+/*
+ * form_parse - 解码表单或查询串s的len字节，字段存入f，名字与值都以'\0'结尾，
+ *    位于请求内存池中，在当前请求结束前有效。没有'='的字段值为空串，空字段被跳过。
+ *    字段数超过FORM_MAXFIELDS时返回-1。
+ */
+int form_parse(form_t *f, const char *s, size_t len)
+{
+    const char *end = s + len, *q;
+    char *out = arena_alloc(2 * len + 2); // 解码后不会变长，每个字段另加两个'\0'
+    char *name = out, *value = NULL;
+
+    f->n = 0;
+    for (;;)
+    {
+        q = scan_special(s, end);
+        memcpy(out, s, q - s);
+        out += q - s;
+        s = q;
+        if (s == end || *s == '&') // 一个字段结束
+        {
+            *out++ = '\0';
+            if (value == NULL && out - 1 > name) // 只有名字
+            {
+                value = out;
+                *out++ = '\0';
+            }
+            if (value)
+            {
+                if (f->n == FORM_MAXFIELDS)
+                    return -1;
+                f->field[f->n].name = name;
+                f->field[f->n].value = value;
+                f->field[f->n++].vlen = out - 1 - value;
+            }
+            if (s == end)
+                return 0;
+            s++;
+            name = out;
+            value = NULL;
+        }
+        else if (*s == '=')
+        {
+            if (value) // 值中的'='
+                *out++ = '=';
+            else
+            {
+                *out++ = '\0';
+                value = out;
+            }
+            s++;
+        }
+        else if (*s == '+')
+        {
+            *out++ = ' ';
+            s++;
+        }
+        else
+            s += decode_pct(s, end, out++);
+    }
+}
+
+/* form_get - 名为name的第一个字段的值，没有时返回NULL */
+const char *form_get(const form_t *f, const char *name)
+{
+    int i;
+
+    for (i = 0; i < f->n; i++)
+        if (!strcmp(f->field[i].name, name))
+            return f->field[i].value;
+    return NULL;
+}
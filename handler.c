@@ -0,0 +1,54 @@
+#include "sever.h"
+
+/*
+ * 进程内动态处理程序：在路由表中注册的函数直接在工作线程中生成响应，
+ * 省去每个请求fork/exec CGI程序的开销。未注册的动态路径只有在用-x启用
+ * 外部CGI时才交给CGI程序处理。
+ */
+
+/*
+ * handler_run - 调用处理程序并发送其响应。
+ *    响应预先以200 OK开始，处理程序可以用resp_init重新开始以返回其他状态，
+ *    也可以用resp_stream_*或clienterror等自行发送，此时应置resp->sent。
+ */
+void handler_run(handler_fn fn, request_t *rq, const char *query)
+{
+    response_t resp;
+
+    resp_init(&resp, rq, 200, "OK");
+    fn(rq, query, &resp);
+    if (!resp.sent) // 处理程序可能已自行发送（如分块传输）
+        resp_send(&resp);
+}
+
+/*
+ * 加法计算器，与calculate/add.c的输出相同：查询串为"n1&n2"，返回"sum=n1+n2"。
+ *    以POST提交时参数取自信息体。
+ */
+static void handler_add(request_t *rq, const char *query, response_t *resp)
+{
+    const char *p;
+    size_t len;
+
+    if (!rq->body.eof && (query = body_buffer(&rq->body, &len)) == NULL)
+    {
+        rq->keepalive = 0; // 信息体读取失败，无法确定下一个请求的起点
+        resp_init(resp, rq, rq->body.status, rq->body.reason);
+        return;
+    }
+    if ((p = strchr(query, '&')) == NULL) // 解析参数
+    {
+        resp_init(resp, rq, 400, "Bad Request");
+        resp_header(resp, "Content-type: text/plain");
+        resp_bodyf(resp, "invalid query string: %s\n", query);
+        return;
+    }
+    resp_header(resp, "Content-type:application/json");
+    resp_bodyf(resp, "sum=%d", atoi(query) + atoi(p + 1)); // 计算和并输出结果
+}
+
+/* handler_init - 注册内置的处理程序 */
+void handler_init(void)
+{
+    route_add(ROUTE_GET | ROUTE_POST, "/calculate/add", handler_add);
+}
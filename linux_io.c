@@ -0,0 +1,139 @@
+/*
+ * Linux专用的扩展：零拷贝I/O、accept4与线程绑定CPU。
+ * splice、accept4、pthread_setaffinity_np等接口需要_GNU_SOURCE，而_GNU_SOURCE会让<netdb.h>声明与csapp.h中
+ * gai_error同名的GNU函数，因此本文件不包含csapp.h，只包含所需的系统头文件，
+ * 对外函数的原型与csapp.h中的声明保持一致。
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#define SPLICE_CHUNK 65536 // splice每次经由管道搬运的最大字节数
+
+int rio_wait(int fd, short events); // csapp.c
+
+/*
+ * rio_splice - 经由管道把in_fd从offset开始的count字节搬运到out_fd，
+ *    数据只在内核页之间移动。用于sendfile不支持的文件系统。
+ */
+static ssize_t rio_splice(int out_fd, int in_fd, off_t offset, size_t count)
+{
+    int pfd[2];
+    size_t nleft = count;
+    ssize_t nin, nout;
+
+    if (pipe2(pfd, O_CLOEXEC) < 0)
+        return -1;
+    while (nleft > 0)
+    {
+        if ((nin = splice(in_fd, &offset, pfd[1], NULL, nleft < SPLICE_CHUNK ? nleft : SPLICE_CHUNK, SPLICE_F_MOVE)) <= 0)
+        {
+            if (nin < 0 && errno == EINTR)
+                continue;
+            break; // 出错或文件被截断
+        }
+        while (nin > 0) // 把管道中的数据全部推送到套接字
+        {
+            if ((nout = splice(pfd[0], NULL, out_fd, NULL, nin, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN && rio_wait(out_fd, POLLOUT) == 0)
+                    continue;
+                close(pfd[0]);
+                close(pfd[1]);
+                return -1;
+            }
+            nin -= nout;
+            nleft -= nout;
+        }
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+    return nleft == count ? -1 : (ssize_t)(count - nleft);
+}
+
+/*
+ * rio_sendfile - 把in_fd从offset开始的count字节零拷贝地发送到out_fd。
+ *    处理部分写入与EAGAIN（非阻塞套接字），从中断处继续发送，直到全部发完；
+ *    内核或文件系统不支持sendfile时改用splice。返回发送的字节数，出错返回-1。
+ */
+ssize_t rio_sendfile(int out_fd, int in_fd, off_t offset, size_t count)
+{
+    size_t nleft = count;
+    ssize_t n;
+
+    while (nleft > 0)
+    {
+        if ((n = sendfile(out_fd, in_fd, &offset, nleft)) < 0) // 内核自动推进offset
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && rio_wait(out_fd, POLLOUT) == 0) // 套接字发送缓冲区已满，等待后从offset处继续
+                continue;
+            if (errno == EINVAL || errno == ENOSYS) // 不支持sendfile，剩余部分改用splice
+            {
+                if ((n = rio_splice(out_fd, in_fd, offset, nleft)) < 0)
+                    return -1;
+                nleft -= n;
+                break;
+            }
+            return -1;
+        }
+        if (n == 0) // 文件在发送过程中被截断
+            break;
+        nleft -= n;
+    }
+    return count - nleft;
+}
+
+/*
+ * accept_nonblock - 接受一个连接，新描述符直接带有O_NONBLOCK与FD_CLOEXEC，
+ *    省去两次fcntl；内核不支持accept4时退回accept加fcntl。
+ */
+int accept_nonblock(int s, struct sockaddr *addr, socklen_t *addrlen)
+{
+    static int no_accept4; // 已知内核不支持accept4
+    int fd;
+
+    if (!no_accept4)
+    {
+        if ((fd = accept4(s, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 || errno != ENOSYS)
+            return fd;
+        no_accept4 = 1;
+    }
+    if ((fd = accept(s, addr, addrlen)) < 0)
+        return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/*
+ * thread_pin - 把调用线程绑定到其当前可用CPU中的第n个上（按可用CPU数取模，
+ *    进程已被taskset等限制时只在允许的CPU中选择）。成功返回0，失败返回-1。
+ */
+int thread_pin(int n)
+{
+    cpu_set_t allowed, set;
+    int cpu, count;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || (count = CPU_COUNT(&allowed)) == 0)
+        return -1;
+    n %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+            break;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "sever.h"
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+/*
+ * 访问日志：每个线程一个单生产者单消费者的环形缓冲区，线程把格式化好的日志行
+ * 追加进去，通常既不加锁也不做系统调用；后台刷新线程定期把所有缓冲区的内容
+ * 攒成大块写入日志文件，某个缓冲区过半时由生产者提前唤醒。缓冲区已满时丢弃
+ * 该条记录并计数，工作线程从不等待磁盘。
+ * 日志文件超过config.log_rotate字节时轮转为path.1、path.2……，保留LOG_KEEP个。
+ */
+
+#define LOG_RING (256 * 1024)  // 每个线程的环形缓冲区大小，须为2的幂
+#define LOG_LINE 1024          // 一条日志的最大长度，过长时截断
+#define LOG_BATCH (256 * 1024) // 刷新线程一次写入的最大字节数
+#define LOG_INTERVAL_MS 100    // 刷新间隔（毫秒）
+#define LOG_KEEP 5             // 轮转后保留的旧文件数
+
+typedef struct log_ring
+{
+    _Atomic size_t head;                 // 生产者已写入的总字节数
+    char pad[64 - sizeof(size_t)];       // head与tail分处不同的缓存行
+    _Atomic size_t tail;                 // 刷新线程已取走的总字节数
+    _Atomic int closed;                  // 所属线程已退出，取空后由刷新线程释放
+    struct log_ring *next;               // 全部缓冲区的链表
+    unsigned long seq;                   // 本线程的请求计数，用于采样
+    time_t sec;                          // stamp对应的秒
+    char stamp[32];                      // 缓存的时间戳，每秒最多格式化一次
+    char data[LOG_RING];
+} log_ring_t;
+
+static log_ring_t *rings;                                     // 新缓冲区插在表头
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER; // 保护链表，只在注册与刷新时使用
+static pthread_key_t log_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static _Atomic unsigned long dropped; // 因缓冲区已满丢弃的记录数
+
+static int log_fd = STDOUT_FILENO; // 未指定日志文件时写到标准输出
+static int wake_fd = -1;           // 唤醒刷新线程的eventfd
+static off_t log_size;             // 当前日志文件的大小
+
+static void ring_release(void *arg)
+{
+    log_ring_t *r = arg;
+
+    atomic_store_explicit(&r->closed, 1, memory_order_release);
+}
+
+static void log_key_init(void)
+{
+    pthread_key_create(&log_key, ring_release);
+}
+
+/* 调用线程的环形缓冲区，第一次使用时创建并登记 */
+static log_ring_t *ring_get(void)
+{
+    log_ring_t *r;
+
+    pthread_once(&log_once, log_key_init);
+    if ((r = pthread_getspecific(log_key)) == NULL)
+    {
+        r = Calloc(1, sizeof(log_ring_t));
+        pthread_mutex_lock(&rings_lock);
+        r->next = rings;
+        rings = r;
+        pthread_mutex_unlock(&rings_lock);
+        pthread_setspecific(log_key, r);
+    }
+    return r;
+}
+
+/* 追加一条完整的日志行，剩余空间不足时丢弃 */
+static void ring_put(log_ring_t *r, const char *line, size_t len)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t off = head & (LOG_RING - 1), n;
+
+    if (LOG_RING - (head - tail) < len)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    n = len < LOG_RING - off ? len : LOG_RING - off; // 到缓冲区末尾时绕回开头
+    memcpy(r->data + off, line, n);
+    memcpy(r->data, line + n, len - n);
+    atomic_store_explicit(&r->head, head + len, memory_order_release); // 数据写完后才对刷新线程可见
+    if (head - tail < LOG_RING / 2 && head + len - tail >= LOG_RING / 2) // 刚刚越过一半，不等下一次定时刷新
+        eventfd_write(wake_fd, 1);
+}
+
+/* 本线程缓存的当前时间戳 */
+static const char *ring_stamp(log_ring_t *r)
+{
+    struct timespec ts;
+    struct tm tm;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (ts.tv_sec != r->sec)
+    {
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(r->stamp, sizeof(r->stamp), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        r->sec = ts.tv_sec;
+    }
+    return r->stamp;
+}
+
+/* 日志文件超过上限时依次改名为path.1 ... path.LOG_KEEP并重新打开 */
+static void log_rotate(void)
+{
+    char from[MAXLINE], to[MAXLINE];
+    int i, fd;
+
+    for (i = LOG_KEEP - 1; i >= 0; i--)
+    {
+        if (i == 0)
+            snprintf(from, sizeof(from), "%s", config.log_path);
+        else
+            snprintf(from, sizeof(from), "%s.%d", config.log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", config.log_path, i + 1);
+        rename(from, to);
+    }
+    if ((fd = open(config.log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+    {
+        fprintf(stderr, "log: cannot reopen %s: %s\n", config.log_path, strerror(errno));
+        return; // 继续写入改名后的文件
+    }
+    dup2(fd, log_fd);
+    close(fd);
+    log_size = 0;
+}
+
+static void log_write(const char *buf, size_t len)
+{
+    if (rio_writen(log_fd, (void *)buf, len) < 0)
+        return;
+    log_size += len;
+    if (config.log_path && config.log_rotate && log_size >= (off_t)config.log_rotate)
+        log_rotate();
+}
+
+/* 取空所有缓冲区并写入日志文件，释放已退出线程的缓冲区 */
+static void log_drain(void)
+{
+    static char batch[LOG_BATCH]; // 只在持有rings_lock时使用
+    size_t blen = 0, head, tail, off, n;
+    log_ring_t *r, **pp;
+
+    pthread_mutex_lock(&rings_lock);
+    for (pp = &rings; (r = *pp) != NULL;)
+    {
+        head = atomic_load_explicit(&r->head, memory_order_acquire);
+        tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        while (tail != head)
+        {
+            if (blen == LOG_BATCH)
+            {
+                log_write(batch, blen);
+                blen = 0;
+            }
+            off = tail & (LOG_RING - 1);
+            n = head - tail;
+            if (n > LOG_RING - off)
+                n = LOG_RING - off;
+            if (n > LOG_BATCH - blen)
+                n = LOG_BATCH - blen;
+            memcpy(batch + blen, r->data + off, n);
+            blen += n;
+            tail += n;
+            atomic_store_explicit(&r->tail, tail, memory_order_release); // 空间交还生产者
+        }
+        if (atomic_load_explicit(&r->closed, memory_order_acquire) &&
+            atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+        {
+            *pp = r->next;
+            free(r);
+            continue;
+        }
+        pp = &r->next;
+    }
+    if (blen > 0)
+        log_write(batch, blen);
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static void *log_flusher(void *arg)
+{
+    struct pollfd pfd = {wake_fd, POLLIN, 0};
+    eventfd_t n;
+
+    for (;;)
+    {
+        if (poll(&pfd, 1, LOG_INTERVAL_MS) > 0)
+            eventfd_read(wake_fd, &n);
+        log_drain();
+    }
+    return NULL;
+}
+
+/*
+ * log_init - 打开日志文件（config.log_path为NULL时使用标准输出）并启动刷新线程，
+ *    须在创建线程池之前调用。进程正常退出时写出剩余的记录。
+ */
+void log_init(void)
+{
+    struct stat sbuf;
+    pthread_t tid;
+    int fd;
+
+    if (config.log_level == LOG_OFF)
+        return;
+    if (config.log_path)
+    {
+        if ((fd = open(config.log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+            unix_error("log open error");
+        log_fd = fd;
+        if (fstat(fd, &sbuf) == 0)
+            log_size = sbuf.st_size;
+    }
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        unix_error("log eventfd error");
+    atexit(log_drain);
+    Pthread_create(&tid, NULL, log_flusher, NULL);
+    Pthread_detach(tid);
+}
+
+/*
+ * log_access - 以Common Log Format加上处理耗时（微秒）记录一个请求，method为NULL
+ *    表示请求行无法解析。客户端记为数字地址，config.log_hostnames为真时改用
+ *    后台解析得到的主机名（尚未解析完成时仍为数字地址）。config.log_sample为n时只记录每个线程每n个请求中的一个，
+ *    状态码不小于400的请求总是记录。
+ */
+void log_access(const request_t *rq, const char *method, const char *target, long usec)
+{
+    char line[LOG_LINE], host[256];
+    const char *peer = rq->conn->peer;
+    log_ring_t *r;
+    int n;
+
+    if (config.log_level < LOG_ACCESS)
+        return;
+    r = ring_get();
+    if (config.log_sample > 1 && r->seq++ % config.log_sample != 0 && rq->status < 400)
+        return;
+    if (config.log_hostnames) // 只取缓存中的结果，不等待DNS
+        peer = resolve_host(peer, host, sizeof(host));
+    if (method)
+        n = snprintf(line, sizeof(line), "%s - - [%s] \"%s %s HTTP/1.%d\" %d %zu %ld\n", peer, ring_stamp(r),
+                     method, target, rq->http11, rq->status, rq->bytes, usec);
+    else
+        n = snprintf(line, sizeof(line), "%s - - [%s] \"-\" %d %zu %ld\n", peer, ring_stamp(r),
+                     rq->status, rq->bytes, usec);
+    if (n >= (int)sizeof(line)) // 截断过长的请求目标，保留行尾
+    {
+        n = sizeof(line) - 1;
+        line[n - 1] = '\n';
+    }
+    ring_put(r, line, n);
+}
+
+/* log_verbose - 记录一条调试信息（连接的建立等），只在config.log_level为LOG_VERBOSE时记录 */
+void log_verbose(const char *fmt, ...)
+{
+    char line[LOG_LINE];
+    log_ring_t *r;
+    va_list ap;
+    int n;
+
+    if (config.log_level < LOG_VERBOSE)
+        return;
+    r = ring_get();
+    n = snprintf(line, sizeof(line), "[%s] ", ring_stamp(r));
+    va_start(ap, fmt);
+    n += vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof(line) - 1)
+        n = sizeof(line) - 2;
+    line[n++] = '\n';
+    ring_put(r, line, n);
+}
+
+/* log_dropped - 因缓冲区已满而丢弃的记录数 */
+unsigned long log_dropped(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
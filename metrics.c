@@ -0,0 +1,267 @@
+#include "sever.h"
+#include <stdatomic.h>
+
+/*
+ * 运行指标：每个线程一块计数区，只由所属线程更新，用relaxed的读后写代替带锁的
+ * 原子加法，热路径上没有锁和总线锁定。抓取/metrics时把所有线程的计数区相加，
+ * 以Prometheus文本格式输出。线程退出后计数区保留，计数保持单调。
+ *
+ * 耗时直方图采用HDR式的对数-线性分桶：单位为微秒，小于4的值各占一桶，
+ * 之后每个2的幂区间再均分为4桶，相对误差不超过25%，桶数与量程的对数成正比。
+ * 超出量程的值计入最后一桶，该桶没有有限的上界，只在le="+Inf"中体现。
+ *
+ * 指标暴露了流量与路由信息，默认只应答来自本机的抓取请求（-M对所有客户端开放）。
+ */
+
+#define HIST_SUB 4                      // 每个2的幂区间的桶数
+#define HIST_OCTAVES 27                 // 量程为2^27微秒（约134秒），更大的值计入最后一桶
+#define HIST_BUCKETS (HIST_SUB * HIST_OCTAVES)
+#define STATUS_CLASSES 5                // 1xx～5xx
+
+typedef _Atomic unsigned long mcount_t;
+
+typedef struct
+{
+    mcount_t bucket[HIST_BUCKETS];
+    mcount_t sum; // 微秒数之和
+} hist_t;
+
+/* 一个线程的计数区，路由编号为ROUTE_MAX的一组计数记录未匹配任何路由的请求 */
+typedef struct metrics_block
+{
+    struct metrics_block *next;
+    mcount_t counter[M_NCOUNTERS];
+    mcount_t requests[ROUTE_MAX + 1][STATUS_CLASSES];
+    hist_t latency[ROUTE_MAX + 1];
+    hist_t sqlite;
+} metrics_block_t;
+
+static metrics_block_t *blocks;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER; // 保护链表，只在登记与抓取时使用
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+
+static void metrics_key_init(void)
+{
+    pthread_key_create(&metrics_key, NULL);
+}
+
+/* 调用线程的计数区，第一次使用时创建并登记 */
+static metrics_block_t *block_get(void)
+{
+    metrics_block_t *b;
+
+    pthread_once(&metrics_once, metrics_key_init);
+    if ((b = pthread_getspecific(metrics_key)) == NULL)
+    {
+        b = Calloc(1, sizeof(metrics_block_t));
+        pthread_mutex_lock(&blocks_lock);
+        b->next = blocks;
+        blocks = b;
+        pthread_mutex_unlock(&blocks_lock);
+        pthread_setspecific(metrics_key, b);
+    }
+    return b;
+}
+
+/* 只有所属线程写入，读后写不会丢失更新；抓取线程读到的总是某个完整的值 */
+static void bump(mcount_t *c, unsigned long n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static unsigned long peek(mcount_t *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+/* 值v（微秒）所在的桶 */
+static int hist_index(unsigned long v)
+{
+    int e;
+
+    if (v < HIST_SUB)
+        return (int)v;
+    e = 63 - __builtin_clzl(v); // v的最高位，不小于2
+    if (e >= HIST_OCTAVES)
+        return HIST_BUCKETS - 1;
+    return HIST_SUB * (e - 1) + (int)((v >> (e - 2)) & (HIST_SUB - 1));
+}
+
+/* 桶i能容纳的最大值（微秒） */
+static unsigned long hist_upper(int i)
+{
+    int e = i / HIST_SUB + 1, sub = i % HIST_SUB;
+
+    if (i < HIST_SUB)
+        return i;
+    return ((unsigned long)(HIST_SUB + sub + 1) << (e - 2)) - 1;
+}
+
+static void hist_record(hist_t *h, long usec)
+{
+    if (usec < 0)
+        usec = 0;
+    bump(&h->bucket[hist_index(usec)], 1);
+    bump(&h->sum, usec);
+}
+
+/* metrics_add - 把计数器id加n */
+void metrics_add(int id, unsigned long n)
+{
+    bump(&block_get()->counter[id], n);
+}
+
+/* metrics_request - 记录一个已应答的请求：所属路由（-1表示未匹配）、状态码与处理耗时 */
+void metrics_request(int route, int status, long usec)
+{
+    metrics_block_t *b = block_get();
+    int cls = status / 100 - 1;
+
+    if (route < 0)
+        route = ROUTE_MAX;
+    if (cls >= 0 && cls < STATUS_CLASSES)
+        bump(&b->requests[route][cls], 1);
+    hist_record(&b->latency[route], usec);
+}
+
+/* metrics_sqlite - 记录一次SQLite语句的执行耗时 */
+void metrics_sqlite(long usec)
+{
+    hist_record(&block_get()->sqlite, usec);
+}
+
+/* 把所有线程的计数区相加 */
+static void merge(metrics_block_t *sum)
+{
+    metrics_block_t *b;
+    int i, j;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b; b = b->next)
+    {
+        for (i = 0; i < M_NCOUNTERS; i++)
+            sum->counter[i] += peek(&b->counter[i]);
+        for (i = 0; i <= ROUTE_MAX; i++)
+        {
+            for (j = 0; j < STATUS_CLASSES; j++)
+                sum->requests[i][j] += peek(&b->requests[i][j]);
+            for (j = 0; j < HIST_BUCKETS; j++)
+                sum->latency[i].bucket[j] += peek(&b->latency[i].bucket[j]);
+            sum->latency[i].sum += peek(&b->latency[i].sum);
+        }
+        for (j = 0; j < HIST_BUCKETS; j++)
+            sum->sqlite.bucket[j] += peek(&b->sqlite.bucket[j]);
+        sum->sqlite.sum += peek(&b->sqlite.sum);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+/* 输出一个直方图，label为空串时不带标签；有限上界的桶只输出到最后一个非空的桶为止 */
+static void hist_print(FILE *fp, const char *name, const char *label, hist_t *h)
+{
+    unsigned long count = 0;
+    int i, last = -1;
+
+    for (i = 0; i < HIST_BUCKETS - 1; i++) // 最后一桶收纳超出量程的值，没有有限上界
+        if (h->bucket[i])
+            last = i;
+    for (i = 0; i <= last; i++)
+    {
+        count += h->bucket[i];
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, label, *label ? "," : "", hist_upper(i) / 1e6, count);
+    }
+    for (; i < HIST_BUCKETS; i++)
+        count += h->bucket[i];
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, label, *label ? "," : "", count);
+    fprintf(fp, "%s_sum%s%s%s %g\n", name, *label ? "{" : "", label, *label ? "}" : "", h->sum / 1e6);
+    fprintf(fp, "%s_count%s%s%s %lu\n", name, *label ? "{" : "", label, *label ? "}" : "", count);
+}
+
+/* 客户端是否来自本机（数字地址，含IPv4映射的IPv6地址） */
+static int peer_local(const char *peer)
+{
+    if (!strncmp(peer, "::ffff:", 7))
+        peer += 7;
+    return !strncmp(peer, "127.", 4) || !strcmp(peer, "::1");
+}
+
+/* GET /metrics：以Prometheus文本格式输出全部指标 */
+static void metrics_handler(request_t *rq, const char *query, response_t *resp)
+{
+    metrics_block_t *sum = Calloc(1, sizeof(metrics_block_t));
+    cache_stats_t st;
+    char label[MAXLINE];
+    const char *route;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp;
+    int i, j;
+
+    if (!config.metrics_public && !peer_local(rq->conn->peer))
+    {
+        free(sum);
+        resp->sent = 1; // 响应由clienterror发出
+        clienterror(rq, rq->path, "403", "Forbidden", "Book sever only serves metrics to local clients");
+        return;
+    }
+    merge(sum);
+    cache_getstats(&st);
+    if ((fp = open_memstream(&buf, &len)) == NULL)
+    {
+        free(sum);
+        resp_init(resp, rq, 500, "Internal Server Error");
+        return;
+    }
+
+    fprintf(fp, "# TYPE book_connections_accepted_total counter\n"
+                "book_connections_accepted_total %lu\n",
+            sum->counter[M_CONN_ACCEPTED]);
+    fprintf(fp, "# TYPE book_connections_active gauge\n"
+                "book_connections_active %lu\n",
+            sum->counter[M_CONN_ACCEPTED] - sum->counter[M_CONN_CLOSED]);
+    fprintf(fp, "# TYPE book_request_bytes_total counter\n"
+                "book_request_bytes_total %lu\n",
+            sum->counter[M_BYTES_IN]);
+    fprintf(fp, "# TYPE book_response_bytes_total counter\n"
+                "book_response_bytes_total %lu\n",
+            sum->counter[M_BYTES_OUT]);
+    fprintf(fp, "# TYPE book_cgi_forks_total counter\n"
+                "book_cgi_forks_total %lu\n",
+            sum->counter[M_CGI_FORKS]);
+    fprintf(fp, "# TYPE book_log_dropped_total counter\n"
+                "book_log_dropped_total %lu\n",
+            log_dropped());
+    fprintf(fp, "# TYPE book_cache_hits_total counter\nbook_cache_hits_total %lu\n", st.hits);
+    fprintf(fp, "# TYPE book_cache_misses_total counter\nbook_cache_misses_total %lu\n", st.misses);
+    fprintf(fp, "# TYPE book_cache_bytes gauge\nbook_cache_bytes %zu\n", st.bytes);
+
+    fprintf(fp, "# TYPE book_requests_total counter\n");
+    for (i = 0; i <= ROUTE_MAX; i++)
+        for (j = 0; j < STATUS_CLASSES; j++)
+            if (sum->requests[i][j])
+                fprintf(fp, "book_requests_total{route=\"%s\",status=\"%dxx\"} %lu\n",
+                        (route = route_pattern(i)) ? route : "unmatched", j + 1, sum->requests[i][j]);
+
+    fprintf(fp, "# TYPE book_request_duration_seconds histogram\n");
+    for (i = 0; i <= ROUTE_MAX; i++)
+    {
+        if (i < ROUTE_MAX && route_pattern(i) == NULL)
+            continue;
+        snprintf(label, sizeof(label), "route=\"%s\"", i < ROUTE_MAX ? route_pattern(i) : "unmatched");
+        hist_print(fp, "book_request_duration_seconds", label, &sum->latency[i]);
+    }
+    fprintf(fp, "# TYPE book_sqlite_query_duration_seconds histogram\n");
+    hist_print(fp, "book_sqlite_query_duration_seconds", "", &sum->sqlite);
+    fclose(fp);
+    free(sum);
+
+    resp_header(resp, "Content-type: text/plain; version=0.0.4");
+    resp_body_owned(resp, buf, len);
+}
+
+/* metrics_init - 注册/metrics */
+void metrics_init(void)
+{
+    route_add(ROUTE_GET, "/metrics", metrics_handler);
+}
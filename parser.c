@@ -0,0 +1,353 @@
+#include "sever.h"
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * HTTP/1.x请求头部解析器。直接在连接的rio缓冲区上工作，请求行与各头部行
+ * 只记录为指向缓冲区的片段，不做复制。数据分多次到达时，解析器保存当前状态与
+ * 已扫描到的位置，下次只扫描新到达的部分。头部完整后把每个片段结尾的分隔符
+ * （空格、冒号、CR/LF）改写为'\0'，片段可直接当作C字符串使用。常用头部在解析时
+ * 经完美哈希定位到固定槽位，取值不必再逐行比较名字。
+ *
+ * 请求目标与头部值这类较长的片段用SSE2每次比较16字节来查找分隔符与控制字符，
+ * 方法名与头部名很短，逐字节查表校验。
+ */
+
+enum
+{
+    S_START,    // 请求行之前，跳过多余的空行
+    S_METHOD,   // 请求方法
+    S_TARGET,   // 请求目标
+    S_VERSION,  // 协议版本
+    S_HDR,      // 头部行的行首
+    S_NAME,     // 头部名
+    S_VALUE_WS, // 冒号之后的空白
+    S_VALUE,    // 头部值
+    S_DONE,     // 头部完整
+    S_ERROR     // 格式错误或超出限制
+};
+
+/* RFC 9110中token允许的字符，按位存放 */
+static const unsigned int tchar[8] = {0, 0x03ff6cfa, 0xc7fffffe, 0x57ffffff, 0, 0, 0, 0};
+
+#define IS_TCHAR(c) ((tchar[(unsigned char)(c) >> 5] >> ((unsigned char)(c) & 31)) & 1)
+
+/*
+ * 常用头部名的完美哈希：名字长度加首、尾字母的小写，取低5位。对hdr_id_t中的名字
+ * 互不冲突，新增名字时需重新核对。
+ */
+#define HDR_HASH(len, first, last) (((len) + ((first) | 0x20) + ((last) | 0x20)) & 31)
+
+static const struct
+{
+    const char *name;
+    size_t len;
+} hdr_names[HDR_NKNOWN] = {
+    [HDR_HOST] = {"Host", 4},
+    [HDR_CONNECTION] = {"Connection", 10},
+    [HDR_CONTENT_LENGTH] = {"Content-Length", 14},
+    [HDR_CONTENT_TYPE] = {"Content-Type", 12},
+    [HDR_ACCEPT_ENCODING] = {"Accept-Encoding", 15},
+    [HDR_IF_NONE_MATCH] = {"If-None-Match", 13},
+    [HDR_IF_MODIFIED_SINCE] = {"If-Modified-Since", 17},
+    [HDR_RANGE] = {"Range", 5},
+    [HDR_IF_RANGE] = {"If-Range", 8},
+    [HDR_COOKIE] = {"Cookie", 6},
+    [HDR_TRANSFER_ENCODING] = {"Transfer-Encoding", 17},
+};
+
+/* 哈希值到hdr_id_t加1的映射，0表示不是常用头部 */
+static const unsigned char hdr_slot[32] = {
+    [HDR_HASH(4, 'h', 't')] = HDR_HOST + 1,
+    [HDR_HASH(10, 'c', 'n')] = HDR_CONNECTION + 1,
+    [HDR_HASH(14, 'c', 'h')] = HDR_CONTENT_LENGTH + 1,
+    [HDR_HASH(12, 'c', 'e')] = HDR_CONTENT_TYPE + 1,
+    [HDR_HASH(15, 'a', 'g')] = HDR_ACCEPT_ENCODING + 1,
+    [HDR_HASH(13, 'i', 'h')] = HDR_IF_NONE_MATCH + 1,
+    [HDR_HASH(17, 'i', 'e')] = HDR_IF_MODIFIED_SINCE + 1,
+    [HDR_HASH(5, 'r', 'e')] = HDR_RANGE + 1,
+    [HDR_HASH(8, 'i', 'e')] = HDR_IF_RANGE + 1,
+    [HDR_HASH(6, 'c', 'e')] = HDR_COOKIE + 1,
+    [HDR_HASH(17, 't', 'g')] = HDR_TRANSFER_ENCODING + 1,
+};
+
+/* 头部名对应的hdr_id_t，不是常用头部时返回-1 */
+static int header_id(const char *name, size_t len)
+{
+    int id = hdr_slot[HDR_HASH(len, name[0], name[len - 1])] - 1;
+
+    if (id < 0 || hdr_names[id].len != len || strncasecmp(name, hdr_names[id].name, len))
+        return -1;
+    return id;
+}
+
+/*
+ * scan_ctl - 返回[p, end)中第一个小于limit或等于DEL的字节的位置，没有时返回end。
+ *    limit为0x20时找控制字符（含CR、LF与TAB），为0x21时空格也算作分隔符。
+ */
+static const char *scan_ctl(const char *p, const char *end, unsigned char limit)
+{
+#ifdef __SSE2__
+    const __m128i max = _mm_set1_epi8((char)(limit - 1)), del = _mm_set1_epi8(0x7f);
+    __m128i x, hit;
+    int mask;
+
+    while (end - p >= 16)
+    {
+        x = _mm_loadu_si128((const __m128i *)p);
+        hit = _mm_cmpeq_epi8(_mm_min_epu8(x, max), x); // 无符号比较：x <= limit-1
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, del));
+        if ((mask = _mm_movemask_epi8(hit)) != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && (unsigned char)*p >= limit && *p != 0x7f)
+        p++;
+    return p;
+}
+
+/* 行尾：q指向CR或LF。返回行尾的字节数；CR是最后一个已到达的字节时返回0；不是合法行尾返回-1 */
+static int line_end(const char *q, const char *end)
+{
+    if (*q == '\n')
+        return 1;
+    if (*q != '\r')
+        return -1;
+    if (q + 1 == end)
+        return 0;
+    return q[1] == '\n' ? 2 : -1;
+}
+
+static int parse_fail(http_parser_t *p, int status, const char *reason)
+{
+    p->state = S_ERROR;
+    p->status = status;
+    p->reason = reason;
+    return -1;
+}
+
+/* 缓冲区中的数据被整体移动（rio_fillb压缩缓冲区）后，平移已记录的片段 */
+static void parser_rebase(http_parser_t *p, ptrdiff_t delta)
+{
+    int i;
+
+    if (p->method.p)
+        p->method.p += delta;
+    if (p->target.p)
+        p->target.p += delta;
+    if (p->version.p)
+        p->version.p += delta;
+    for (i = 0; i < p->nhdrs; i++)
+    {
+        p->name[i].p += delta;
+        p->value[i].p += delta;
+    }
+    if (p->state == S_VALUE_WS || p->state == S_VALUE) // 正在解析的头部已记录了名字
+        p->name[p->nhdrs].p += delta;
+}
+
+/* 头部完整后给各片段加上结尾'\0'，被覆盖的都是分隔符 */
+static void parser_terminate(http_parser_t *p)
+{
+    int i;
+
+    ((char *)p->method.p)[p->method.len] = '\0';
+    ((char *)p->target.p)[p->target.len] = '\0';
+    ((char *)p->version.p)[p->version.len] = '\0';
+    for (i = 0; i < p->nhdrs; i++)
+    {
+        ((char *)p->name[i].p)[p->name[i].len] = '\0';
+        ((char *)p->value[i].p)[p->value[i].len] = '\0';
+    }
+}
+
+/* http_parser_init - 准备解析一个新的请求 */
+void http_parser_init(http_parser_t *p)
+{
+    memset(p, 0, offsetof(http_parser_t, name)); // 头部片段数组由nhdrs界定，无需清零
+    p->state = S_START;
+}
+
+/*
+ * http_parse - 解析buf开始的len字节中的请求头部，buf应指向请求的第一个字节。
+ *    可以随数据到达反复调用，buf中已扫描过的部分不会被重新扫描。
+ *    头部完整返回1，headlen为头部（含结尾空行）的长度；尚不完整返回0；
+ *    格式错误或超出限制返回-1，status与reason给出应答的状态码。
+ */
+int http_parse(http_parser_t *p, char *buf, size_t len)
+{
+    const char *s, *q, *v, *end = buf + len;
+    size_t n;
+    int k, id;
+
+    if (p->state == S_DONE)
+        return 1;
+    if (p->state == S_ERROR)
+        return -1;
+    if (p->base && p->base != buf)
+        parser_rebase(p, buf - p->base);
+    p->base = buf;
+    s = buf + p->pos;
+
+    while (s < end)
+    {
+        switch (p->state)
+        {
+        case S_START: // 容忍请求之间多余的CRLF（如表单正文之后的换行）
+            if (*s == '\r' || *s == '\n')
+            {
+                s++;
+                break;
+            }
+            p->mark = s - buf;
+            p->state = S_METHOD;
+            break;
+
+        case S_METHOD:
+            while (s < end && IS_TCHAR(*s))
+                s++;
+            if ((n = s - (buf + p->mark)) > HTTP_MAXMETHOD)
+                return parse_fail(p, 501, "Not Implemented");
+            if (s == end)
+                goto more;
+            if (*s != ' ' || n == 0)
+                return parse_fail(p, 400, "Bad Request");
+            p->method.p = buf + p->mark;
+            p->method.len = n;
+            p->mark = ++s - buf;
+            p->state = S_TARGET;
+            break;
+
+        case S_TARGET:
+            q = scan_ctl(s, end, 0x21);
+            if ((n = q - (buf + p->mark)) > HTTP_MAXURI)
+                return parse_fail(p, 414, "URI Too Long");
+            s = q;
+            if (s == end)
+                goto more;
+            if (*s != ' ' || n == 0)
+                return parse_fail(p, 400, "Bad Request");
+            p->target.p = buf + p->mark;
+            p->target.len = n;
+            p->mark = ++s - buf;
+            p->state = S_VERSION;
+            break;
+
+        case S_VERSION:
+            s = scan_ctl(s, end, 0x20);
+            v = buf + p->mark;
+            if ((n = s - v) > 8)
+                return strncmp(v, "HTTP/", 5) ? parse_fail(p, 400, "Bad Request") : parse_fail(p, 505, "HTTP Version Not Supported");
+            if (s == end)
+                goto more;
+            if ((k = line_end(s, end)) == 0)
+                goto more;
+            if (k < 0 || n != 8 || strncmp(v, "HTTP/", 5) || v[6] != '.' || !isdigit((unsigned char)v[7]))
+                return parse_fail(p, 400, "Bad Request");
+            if (v[5] != '1')
+                return parse_fail(p, 505, "HTTP Version Not Supported");
+            p->version.p = v;
+            p->version.len = n;
+            p->minor = v[7] - '0';
+            s += k;
+            p->state = S_HDR;
+            break;
+
+        case S_HDR:
+            if (*s == '\r' || *s == '\n') // 空行，头部结束
+            {
+                if ((k = line_end(s, end)) == 0)
+                    goto more;
+                if (k < 0)
+                    return parse_fail(p, 400, "Bad Request");
+                s += k;
+                p->headlen = s - buf;
+                p->pos = p->headlen;
+                p->state = S_DONE;
+                parser_terminate(p);
+                return 1;
+            }
+            if (*s == ' ' || *s == '\t') // 已废弃的折行写法
+                return parse_fail(p, 400, "Bad Request");
+            if (p->nhdrs == HTTP_MAXHDRS)
+                return parse_fail(p, 431, "Request Header Fields Too Large");
+            p->mark = s - buf;
+            p->state = S_NAME;
+            break;
+
+        case S_NAME:
+            while (s < end && IS_TCHAR(*s))
+                s++;
+            if (s == end)
+                goto more;
+            if (*s != ':' || s == buf + p->mark) // 名字与冒号之间不允许有空白
+                return parse_fail(p, 400, "Bad Request");
+            p->name[p->nhdrs].p = buf + p->mark;
+            p->name[p->nhdrs].len = s - (buf + p->mark);
+            s++;
+            p->state = S_VALUE_WS;
+            break;
+
+        case S_VALUE_WS:
+            while (s < end && (*s == ' ' || *s == '\t'))
+                s++;
+            if (s == end)
+                goto more;
+            p->mark = s - buf;
+            p->state = S_VALUE;
+            break;
+
+        case S_VALUE:
+            while ((q = scan_ctl(s, end, 0x20)) < end && *q == '\t') // 值中允许制表符
+                s = q + 1;
+            s = q;
+            if (s == end)
+                goto more;
+            if ((k = line_end(s, end)) == 0)
+                goto more;
+            if (k < 0)
+                return parse_fail(p, 400, "Bad Request");
+            for (v = s; v > buf + p->mark && (v[-1] == ' ' || v[-1] == '\t'); v--) // 去掉结尾的空白
+                ;
+            p->value[p->nhdrs].p = buf + p->mark;
+            p->value[p->nhdrs].len = v - (buf + p->mark);
+            if ((id = header_id(p->name[p->nhdrs].p, p->name[p->nhdrs].len)) >= 0)
+            {
+                if (p->known[id] && id == HDR_CONTENT_LENGTH) // 重复的长度可能被前后两端理解成不同的请求边界
+                    return parse_fail(p, 400, "Bad Request");
+                if (!p->known[id]) // 重复出现时以第一个为准
+                    p->known[id] = p->nhdrs + 1;
+            }
+            p->nhdrs++;
+            s += k;
+            p->state = S_HDR;
+            break;
+        }
+    }
+more:
+    p->pos = s - buf;
+    return 0;
+}
+
+/* http_header - 常用头部的值，请求中没有该头部时返回NULL。头部完整后才可调用 */
+const char *http_header(const http_parser_t *p, hdr_id_t id)
+{
+    return p->known[id] ? p->value[p->known[id] - 1].p : NULL;
+}
+
+/* http_header_find - 按名字（不区分大小写）查找任意头部的值，没有时返回NULL */
+const char *http_header_find(const http_parser_t *p, const char *name)
+{
+    size_t len = strlen(name);
+    int i;
+
+    if (len > 0 && (i = header_id(name, len)) >= 0)
+        return http_header(p, i);
+    for (i = 0; i < p->nhdrs; i++)
+        if (p->name[i].len == len && !strcasecmp(p->name[i].p, name))
+            return p->value[i].p;
+    return NULL;
+}
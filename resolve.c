@@ -0,0 +1,146 @@
+#include "sever.h"
+
+/*
+ * 客户端主机名的异步反向解析：访问日志要求记录主机名时（-H）先查本表，命中则使用
+ * 缓存的主机名，否则立即返回数字地址，并把地址交给后台解析线程，下次再来时即可命中。
+ * 反应堆与工作线程从不等待DNS。表的大小固定，地址按哈希值直接映射到槽位，新地址
+ * 覆盖同一槽位中的旧记录；解析结果（包括失败）只在一段时间内有效。
+ */
+
+#define RESOLVE_SLOTS 1024  // 缓存槽位数，须为2的幂
+#define RESOLVE_QUEUE 256   // 待解析队列的容量，已满时本次不解析
+#define RESOLVE_THREADS 2   // 解析线程数，一个慢查询不会挡住其余地址
+#define RESOLVE_TTL 300     // 解析成功的结果的有效期（秒）
+#define RESOLVE_NEG_TTL 60  // 解析失败的结果的有效期（秒）
+#define RESOLVE_NAMELEN 256 // 主机名的最大长度（含结尾'\0'）
+
+typedef struct
+{
+    char addr[64];              // 数字地址，空串表示空槽
+    char name[RESOLVE_NAMELEN]; // 主机名，空串表示解析失败
+    time_t expire;              // 过期时间（单调时钟），0表示正在解析
+} resolve_entry_t;
+
+static resolve_entry_t table[RESOLVE_SLOTS];
+static char queue[RESOLVE_QUEUE][64]; // 待解析地址的环形队列
+static unsigned int qhead, qtail;     // 出队与入队的总次数
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER; // 保护table与queue，临界区内不做任何I/O
+static pthread_cond_t resolve_cond = PTHREAD_COND_INITIALIZER;   // 队列非空
+
+static time_t resolve_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* FNV-1a字符串哈希 */
+static unsigned int resolve_hash(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* 把地址加入待解析队列，须持有resolve_lock；队列已满时返回-1 */
+static int enqueue(const char *addr)
+{
+    if (qtail - qhead == RESOLVE_QUEUE)
+        return -1;
+    snprintf(queue[qtail++ % RESOLVE_QUEUE], sizeof(queue[0]), "%s", addr);
+    pthread_cond_signal(&resolve_cond);
+    return 0;
+}
+
+/* 把数字地址反向解析为主机名，失败时name为空串 */
+static void reverse_lookup(const char *addr, char *name, size_t size)
+{
+    struct addrinfo hints, *res;
+
+    name[0] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST; // 地址本身不需要查询DNS
+    if (getaddrinfo(addr, NULL, &hints, &res) != 0)
+        return;
+    if (getnameinfo(res->ai_addr, res->ai_addrlen, name, size, NULL, 0, NI_NAMEREQD) != 0)
+        name[0] = '\0';
+    freeaddrinfo(res);
+}
+
+static void *resolver(void *arg)
+{
+    char addr[64], name[RESOLVE_NAMELEN];
+    resolve_entry_t *e;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&resolve_lock);
+        while (qhead == qtail)
+            pthread_cond_wait(&resolve_cond, &resolve_lock);
+        memcpy(addr, queue[qhead++ % RESOLVE_QUEUE], sizeof(addr));
+        pthread_mutex_unlock(&resolve_lock);
+
+        reverse_lookup(addr, name, sizeof(name)); // 可能阻塞数秒，不持有锁
+
+        pthread_mutex_lock(&resolve_lock);
+        e = &table[resolve_hash(addr) & (RESOLVE_SLOTS - 1)];
+        if (!strcmp(e->addr, addr)) // 槽位期间可能已被其他地址占用，此时丢弃结果
+        {
+            memcpy(e->name, name, sizeof(name));
+            e->expire = resolve_now() + (name[0] ? RESOLVE_TTL : RESOLVE_NEG_TTL);
+        }
+        pthread_mutex_unlock(&resolve_lock);
+    }
+    return NULL;
+}
+
+/* resolve_init - 启动后台解析线程，只在config.log_hostnames为真时调用 */
+void resolve_init(void)
+{
+    pthread_t tid;
+    int i;
+
+    for (i = 0; i < RESOLVE_THREADS; i++)
+    {
+        Pthread_create(&tid, NULL, resolver, NULL);
+        Pthread_detach(tid);
+    }
+}
+
+/*
+ * resolve_host - 数字地址addr对应的主机名，不阻塞：缓存中有主机名时复制到buf
+ *    并返回buf（过期后重新解析期间沿用旧值），否则返回addr本身，并在需要时安排后台解析。
+ */
+const char *resolve_host(const char *addr, char *buf, size_t size)
+{
+    resolve_entry_t *e = &table[resolve_hash(addr) & (RESOLVE_SLOTS - 1)];
+    const char *host = addr;
+
+    pthread_mutex_lock(&resolve_lock);
+    if (strcmp(e->addr, addr)) // 未缓存，占用槽位并排队
+    {
+        snprintf(e->addr, sizeof(e->addr), "%s", addr);
+        e->name[0] = '\0';
+        e->expire = 0;
+        if (enqueue(addr) < 0)
+            e->addr[0] = '\0'; // 队列已满，留待下次
+    }
+    else
+    {
+        if (e->expire != 0 && e->expire <= resolve_now() && enqueue(addr) == 0) // 过期后重新解析，其间沿用旧结果
+            e->expire = 0;
+        if (e->name[0])
+        {
+            snprintf(buf, size, "%s", e->name);
+            host = buf;
+        }
+    }
+    pthread_mutex_unlock(&resolve_lock);
+    return host;
+}
@@ -0,0 +1,283 @@
+#include "sever.h"
+
+/*
+ * 响应构造器：先收集状态行、头部与若干正文段（借用内存、接管内存或文件区间），
+ * 最后由resp_send统一补上Content-length与Connection并发送。连续的内存段合并成
+ * 一次sendmsg；后面还有文件段时带MSG_MORE，让头部与文件开头合并进同一个TCP报文段。
+ */
+
+/* resp_init - 开始构造一个响应，写入状态行与服务器信息 */
+void resp_init(response_t *r, request_t *rq, int status, const char *reason)
+{
+    r->rq = rq;
+    r->status = status;
+    r->nsegs = 0;
+    r->bodylen = 0;
+    r->sent = 0;
+    r->raw = 0;
+    r->overflow = 0;
+    r->hdrlen = snprintf(r->hdr, sizeof(r->hdr), "HTTP/1.1 %d %s\r\nServer: Book Web Server\r\n", status, reason);
+}
+
+/*
+ * resp_init_raw - 以预先序列化好的头部块开始构造响应（如静态文件缓存中的头部），
+ *    头部块已包含状态行与Content-length，resp_send只补充Connection行
+ */
+void resp_init_raw(response_t *r, request_t *rq, int status, const char *hdr, size_t hdrlen)
+{
+    r->rq = rq;
+    r->status = status;
+    r->nsegs = 0;
+    r->bodylen = 0;
+    r->sent = 0;
+    r->raw = 1;
+    r->overflow = 0;
+    if (hdrlen > sizeof(r->hdr) - RESP_TAIL)
+    {
+        hdrlen = sizeof(r->hdr) - RESP_TAIL;
+        r->overflow = 1;
+    }
+    memcpy(r->hdr, hdr, hdrlen);
+    r->hdrlen = hdrlen;
+}
+
+/* 追加一行头部，并在头部区末尾保留reserve字节；放不下时丢弃该行并记录溢出 */
+static void header_line(response_t *r, size_t reserve, const char *fmt, va_list ap)
+{
+    size_t room = sizeof(r->hdr) - reserve - r->hdrlen;
+    int n;
+
+    if (r->hdrlen + reserve >= sizeof(r->hdr) ||
+        (n = vsnprintf(r->hdr + r->hdrlen, room, fmt, ap)) < 0 || (size_t)n + 2 >= room)
+    {
+        r->hdr[r->hdrlen] = '\0';
+        r->overflow = 1;
+        return;
+    }
+    r->hdrlen += n;
+    r->hdr[r->hdrlen++] = '\r';
+    r->hdr[r->hdrlen++] = '\n';
+}
+
+/*
+ * resp_header - 追加一行头部，fmt不含结尾的\r\n。头部区总为最后几行保留RESP_TAIL字节，
+ *    放不下时丢弃该行，resp_send随后改为应答500
+ */
+void resp_header(response_t *r, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    header_line(r, RESP_TAIL, fmt, ap);
+    va_end(ap);
+}
+
+/* resp_send等追加最后几行，使用保留的空间 */
+static void header_tail(response_t *r, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    header_line(r, 0, fmt, ap);
+    va_end(ap);
+}
+
+static resp_seg_t *resp_seg(response_t *r)
+{
+    if (r->nsegs == RESP_MAXSEGS)
+    {
+        r->overflow = 1; // 丢弃正文段会发出截断的正文
+        return NULL;
+    }
+    return &r->segs[r->nsegs++];
+}
+
+/* 响应已不完整（头部或正文段溢出）：丢弃已构造的内容，改为应答500并关闭连接 */
+static int resp_overflow(response_t *r)
+{
+    static const char err[] = "HTTP/1.1 500 Internal Server Error\r\n"
+                              "Server: Book Web Server\r\n"
+                              "Content-length: 0\r\n"
+                              "Connection: close\r\n\r\n";
+    int i;
+
+    for (i = 0; i < r->nsegs; i++)
+        if (r->segs[i].owned)
+            free((void *)r->segs[i].base);
+    r->nsegs = 0;
+    r->sent = 1;
+    r->rq->status = 500;
+    r->rq->keepalive = 0;
+    log_verbose("Response to %s overflowed, sent 500 instead", r->rq->path);
+    rio_writen(r->rq->fd, err, sizeof(err) - 1);
+    return -1;
+}
+
+/* resp_body - 追加一段借用的正文，buf在resp_send返回前必须保持有效 */
+void resp_body(response_t *r, const void *buf, size_t len)
+{
+    resp_seg_t *sg;
+
+    if (len == 0 || (sg = resp_seg(r)) == NULL)
+        return;
+    sg->base = buf;
+    sg->len = len;
+    sg->owned = 0;
+    sg->fd = -1;
+    r->bodylen += len;
+}
+
+/* resp_body_owned - 追加一段由构造器接管的正文，发送后自动free */
+void resp_body_owned(response_t *r, void *buf, size_t len)
+{
+    resp_seg_t *sg;
+
+    if (len == 0 || (sg = resp_seg(r)) == NULL)
+    {
+        free(buf);
+        return;
+    }
+    sg->base = buf;
+    sg->len = len;
+    sg->owned = 1;
+    sg->fd = -1;
+    r->bodylen += len;
+}
+
+/* resp_bodyf - 按格式追加一段正文，格式化结果由构造器接管 */
+void resp_bodyf(response_t *r, const char *fmt, ...)
+{
+    va_list ap;
+    char *buf;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n <= 0)
+        return;
+    buf = Malloc(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(buf, n + 1, fmt, ap);
+    va_end(ap);
+    resp_body_owned(r, buf, n);
+}
+
+/* resp_file - 追加一段文件区间，由sendfile零拷贝发送；fd仍归调用者所有 */
+void resp_file(response_t *r, int fd, off_t off, size_t len)
+{
+    resp_seg_t *sg;
+
+    if (len == 0 || (sg = resp_seg(r)) == NULL)
+        return;
+    sg->base = NULL;
+    sg->len = len;
+    sg->owned = 0;
+    sg->fd = fd;
+    sg->off = off;
+    r->bodylen += len;
+}
+
+/*
+ * resp_send - 补全头部并发送整个响应，随后释放接管的正文段。
+ *    发送失败时连接已不可用，置rq->keepalive为0并返回-1。
+ */
+int resp_send(response_t *r)
+{
+    request_t *rq = r->rq;
+    struct iovec iov[RESP_MAXSEGS + 1];
+    int i, n = 0, rc = 0;
+
+    if (r->overflow)
+        return resp_overflow(r);
+    r->sent = 1;
+    rq->status = r->status;
+    rq->bytes += r->bodylen;
+    if (!r->raw && r->status != 304) // 304没有正文，也不带Content-length
+        header_tail(r, "Content-length: %zu", r->bodylen);
+    header_tail(r, rq->keepalive ? "Connection: keep-alive" : "Connection: close");
+    header_tail(r, ""); // 头部结束的空行
+
+    iov[n].iov_base = r->hdr;
+    iov[n++].iov_len = r->hdrlen;
+    for (i = 0; i < r->nsegs && rc == 0; i++)
+    {
+        resp_seg_t *sg = &r->segs[i];
+
+        if (sg->base != NULL) // 内存段先攒起来，与相邻的内存段一起发送
+        {
+            iov[n].iov_base = (void *)sg->base;
+            iov[n++].iov_len = sg->len;
+            continue;
+        }
+        if (rio_sendv(rq->fd, iov, n, MSG_MORE) < 0 || // 文件段之前的内容，提示内核稍后还有数据
+            rio_sendfile(rq->fd, sg->fd, sg->off, sg->len) != (ssize_t)sg->len)
+            rc = -1;
+        n = 0;
+    }
+    if (rc == 0 && n > 0 && rio_sendv(rq->fd, iov, n, 0) < 0)
+        rc = -1;
+
+    for (i = 0; i < r->nsegs; i++)
+        if (r->segs[i].owned)
+            free((void *)r->segs[i].base);
+    if (rc < 0)
+        rq->keepalive = 0;
+    return rc;
+}
+
+/*
+ * resp_stream_begin - 以分块传输方式开始发送响应：立即发出头部，正文随后由
+ *    resp_stream_write逐块发送，用于事先不知道长度的正文（如FastCGI的输出）。
+ *    已追加的正文段不会发送。只能用于HTTP/1.1客户端。
+ */
+int resp_stream_begin(response_t *r)
+{
+    if (r->overflow)
+        return resp_overflow(r);
+    r->sent = 1;
+    r->rq->status = r->status;
+    header_tail(r, "Transfer-Encoding: chunked");
+    header_tail(r, r->rq->keepalive ? "Connection: keep-alive" : "Connection: close");
+    header_tail(r, "");
+    if (rio_writen(r->rq->fd, r->hdr, r->hdrlen) < 0)
+    {
+        r->rq->keepalive = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* resp_stream_write - 发送一块正文，len为0时不发送（长度为0的块表示正文结束） */
+int resp_stream_write(response_t *r, const void *buf, size_t len)
+{
+    char size[32];
+    struct iovec iov[3];
+
+    if (len == 0)
+        return 0;
+    iov[0].iov_base = size;
+    iov[0].iov_len = snprintf(size, sizeof(size), "%zx\r\n", len);
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+    iov[2].iov_base = "\r\n";
+    iov[2].iov_len = 2;
+    if (rio_sendv(r->rq->fd, iov, 3, 0) < 0)
+    {
+        r->rq->keepalive = 0;
+        return -1;
+    }
+    r->rq->bytes += len;
+    return 0;
+}
+
+/* resp_stream_end - 发送结束块，完成分块传输的响应 */
+int resp_stream_end(response_t *r)
+{
+    if (rio_writen(r->rq->fd, "0\r\n\r\n", 5) < 0)
+    {
+        r->rq->keepalive = 0;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include "sever.h"
+
+/*
+ * 路由表：压缩前缀树（radix tree），启动时（创建线程池之前）建立，之后只读，
+ * 查找无需加锁。边上保存公共前缀压缩后的字符串，同一节点的静态子节点首字符
+ * 互不相同，查找沿路径逐段下降，代价只与路径长度有关，与路由数量无关。
+ */
+
+// 路由模式：
+//    "/logout"        静态路径
+//    "/user/:id"      ":name"匹配一个路径段（不含'/'），值可用route_param取得
+//    "/calculate/*"   结尾的"*"匹配以该前缀开头的所有路径，剩余部分为参数"*"
+// 同一路径有多种匹配时，静态段优先于参数段，参数段优先于"*"。
+
+static const char *method_names[HTTP_NMETHODS] = {"GET", "POST"};
+
+/* 一个模式在某个方法上的处理程序 */
+typedef struct
+{
+    handler_fn fn;
+    int id; // 路由编号，即模式在patterns中的下标
+} route_entry_t;
+
+typedef struct route_node
+{
+    char *label;                          // 边上的字符串（压缩后的公共前缀）
+    size_t len;                           // label的长度
+    struct route_node **child;            // 静态子节点，首字符互不相同
+    int nchild;
+    struct route_node *param;             // ":name"子节点
+    char *param_name;                     // 参数名（不含':'）
+    route_entry_t handler[HTTP_NMETHODS]; // 路径恰好在此结束时的处理程序
+    route_entry_t mount[HTTP_NMETHODS];   // 以此为前缀的所有路径（模式结尾为"*"）
+} route_node_t;
+
+static route_node_t root;               // 根节点的label为空
+static const char *patterns[ROUTE_MAX]; // 已注册的模式，下标为路由编号
+static int npatterns;
+
+static route_node_t *node_new(const char *label, size_t len)
+{
+    route_node_t *n = Calloc(1, sizeof(route_node_t));
+
+    n->label = Malloc(len + 1);
+    memcpy(n->label, label, len);
+    n->label[len] = '\0';
+    n->len = len;
+    return n;
+}
+
+static route_node_t *find_child(const route_node_t *n, char c)
+{
+    int i;
+
+    for (i = 0; i < n->nchild; i++)
+        if (n->child[i]->label[0] == c)
+            return n->child[i];
+    return NULL;
+}
+
+static void add_child(route_node_t *n, route_node_t *c)
+{
+    n->child = Realloc(n->child, (n->nchild + 1) * sizeof(route_node_t *));
+    n->child[n->nchild++] = c;
+}
+
+/* 在第k个字符处把n的边一分为二，后半段及n原有的子节点与处理程序移到新的子节点中 */
+static void split(route_node_t *n, size_t k)
+{
+    route_node_t *tail = node_new(n->label + k, n->len - k);
+
+    tail->child = n->child;
+    tail->nchild = n->nchild;
+    tail->param = n->param;
+    tail->param_name = n->param_name;
+    memcpy(tail->handler, n->handler, sizeof(n->handler));
+    memcpy(tail->mount, n->mount, sizeof(n->mount));
+
+    n->child = NULL;
+    n->nchild = 0;
+    n->param = NULL;
+    n->param_name = NULL;
+    memset(n->handler, 0, sizeof(n->handler));
+    memset(n->mount, 0, sizeof(n->mount));
+    n->len = k;
+    n->label[k] = '\0';
+    add_child(n, tail);
+}
+
+/* 从n开始插入静态字符串s的len字节，返回其结束处的节点 */
+static route_node_t *insert_static(route_node_t *n, const char *s, size_t len)
+{
+    route_node_t *c;
+    size_t k;
+
+    while (len > 0)
+    {
+        if ((c = find_child(n, s[0])) == NULL)
+        {
+            c = node_new(s, len);
+            add_child(n, c);
+            return c;
+        }
+        for (k = 0; k < c->len && k < len && c->label[k] == s[k]; k++)
+            ;
+        if (k < c->len)
+            split(c, k);
+        n = c;
+        s += k;
+        len -= k;
+    }
+    return n;
+}
+
+/*
+ * route_add - 为methods（以1 << HTTP_xxx为位）注册pattern的处理程序，
+ *    同一模式重复注册时后者生效。模式不以'/'开头、"*"不在结尾、参数名为空、
+ *    同一位置出现不同的参数名或模式数超过ROUTE_MAX时返回-1。
+ */
+int route_add(unsigned methods, const char *pattern, handler_fn fn)
+{
+    route_node_t *n = &root;
+    const char *p = pattern;
+    size_t len;
+    int m, id;
+
+    if (pattern[0] != '/')
+        return -1;
+    for (id = 0; id < npatterns && strcmp(patterns[id], pattern); id++)
+        ;
+    if (id == ROUTE_MAX)
+        return -1;
+    while (*p && *p != '*')
+    {
+        if (*p == ':') // 参数段
+        {
+            len = strcspn(p + 1, "/");
+            if (len == 0 || (n->param && (strlen(n->param_name) != len || strncmp(n->param_name, p + 1, len))))
+                return -1;
+            if (n->param == NULL)
+            {
+                n->param = node_new("", 0);
+                n->param_name = strndup(p + 1, len);
+            }
+            n = n->param;
+            p += 1 + len;
+            continue;
+        }
+        len = strcspn(p, ":*");
+        n = insert_static(n, p, len);
+        p += len;
+    }
+    if (*p == '*' && p[1] != '\0')
+        return -1;
+    if (id == npatterns)
+        patterns[npatterns++] = strdup(pattern);
+    for (m = 0; m < HTTP_NMETHODS; m++)
+        if (methods & (1u << m))
+        {
+            route_entry_t *e = *p == '*' ? &n->mount[m] : &n->handler[m];
+
+            e->fn = fn;
+            e->id = id;
+        }
+    return 0;
+}
+
+static int params_push(route_params_t *params, const char *name, const char *value)
+{
+    if (params->n == ROUTE_MAXPARAMS)
+        return -1;
+    params->name[params->n] = name;
+    params->value[params->n++] = value;
+    return 0;
+}
+
+/* 在n之下匹配剩余路径path，失败时把同一路径上其他方法的处理程序记入*allow */
+static handler_fn match(const route_node_t *n, const char *path, int method, route_params_t *params, unsigned *allow)
+{
+    const route_node_t *c;
+    handler_fn fn;
+    size_t len;
+    char *seg;
+    int m;
+
+    if (*path == '\0')
+    {
+        if (n->handler[method].fn)
+        {
+            params->route = n->handler[method].id;
+            return n->handler[method].fn;
+        }
+        for (m = 0; m < HTTP_NMETHODS; m++)
+            if (n->handler[m].fn)
+                *allow |= 1u << m;
+    }
+    else
+    {
+        if ((c = find_child(n, *path)) != NULL && !strncmp(path, c->label, c->len) &&
+            (fn = match(c, path + c->len, method, params, allow)) != NULL)
+            return fn;
+        if (n->param && *path != '/' && params->n < ROUTE_MAXPARAMS)
+        {
+            len = strcspn(path, "/");
+            seg = arena_alloc(len + 1);
+            memcpy(seg, path, len);
+            seg[len] = '\0';
+            params_push(params, n->param_name, seg);
+            if ((fn = match(n->param, path + len, method, params, allow)) != NULL)
+                return fn;
+            params->n--; // 回溯
+        }
+    }
+    if (n->mount[method].fn)
+    {
+        if (params_push(params, "*", path) < 0)
+            return NULL;
+        params->route = n->mount[method].id;
+        return n->mount[method].fn;
+    }
+    for (m = 0; m < HTTP_NMETHODS; m++)
+        if (n->mount[m].fn)
+            *allow |= 1u << m;
+    return NULL;
+}
+
+/*
+ * route_lookup - 查找method与path（已解码，不含查询串）对应的处理程序，
+ *    路由编号与路径参数存入params，参数在当前请求结束前有效。没有匹配时返回NULL，
+ *    params->route为-1，*allow给出该路径可以使用的方法（以1 << HTTP_xxx为位），
+ *    为0表示路径不存在。
+ */
+handler_fn route_lookup(int method, const char *path, route_params_t *params, unsigned *allow)
+{
+    params->route = -1;
+    params->n = 0;
+    *allow = 0;
+    return match(&root, path, method, params, allow);
+}
+
+/* route_param - 请求中名为name的路径参数，"*"为挂载点之后的剩余路径；没有时返回NULL */
+const char *route_param(const request_t *rq, const char *name)
+{
+    int i;
+
+    for (i = 0; i < rq->params.n; i++)
+        if (!strcmp(rq->params.name[i], name))
+            return rq->params.value[i];
+    return NULL;
+}
+
+/* route_pattern - 编号为id的路由的模式，id为-1（未匹配）时返回NULL */
+const char *route_pattern(int id)
+{
+    return id >= 0 && id < npatterns ? patterns[id] : NULL;
+}
+
+/* http_method - 请求方法对应的编号，不支持的方法返回-1 */
+int http_method(const char *name)
+{
+    int m;
+
+    for (m = 0; m < HTTP_NMETHODS; m++)
+        if (!strcasecmp(name, method_names[m]))
+            return m;
+    return -1;
+}
+
+/* http_method_name - 请求方法编号对应的名字 */
+const char *http_method_name(int method)
+{
+    return method_names[method];
+}
+
+/* route_allow - 把方法集合allow写成Allow头部的值，如"GET, POST" */
+void route_allow(unsigned allow, char *buf, size_t size)
+{
+    size_t n = 0;
+    int m;
+
+    buf[0] = '\0';
+    for (m = 0; m < HTTP_NMETHODS && n < size; m++)
+        if (allow & (1u << m))
+            n += snprintf(buf + n, size - n, "%s%s", n ? ", " : "", method_names[m]);
+}
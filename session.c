@@ -0,0 +1,186 @@
+#include "sever.h"
+#include <sys/random.h>
+
+/*
+ * 会话表：登录成功后生成随机令牌，通过Cookie交给浏览器，之后访问受保护页面时
+ * 只需在内存中查表，不再查询数据库。表按令牌分片，每个分片一把读写锁，
+ * 查找只加读锁，多个工作线程可同时验证。会话有固定的有效期，过期的会话
+ * 由反应堆线程定期清除。
+ */
+
+#define SESSION_SHARDS 16    // 分片数
+#define SESSION_BUCKETS 1024 // 每个分片的哈希桶数
+#define SESSION_SWEEP 60     // 清除过期会话的间隔（秒）
+
+typedef struct session
+{
+    char token[SESSION_TOKEN_LEN + 1]; // 十六进制令牌
+    char user[SESSION_USER_LEN];       // 用户名
+    time_t expire;                     // 过期时间（单调时钟）
+    struct session *next;              // 哈希链
+} session_t;
+
+typedef struct
+{
+    pthread_rwlock_t lock;
+    session_t *buckets[SESSION_BUCKETS];
+    size_t count; // 本分片的会话数
+} session_shard_t;
+
+static session_shard_t shards[SESSION_SHARDS];
+static time_t last_sweep;
+
+static time_t session_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* 检查令牌格式并取其前8位作为哈希值；令牌本身是随机数，无需再做散列 */
+static int token_hash(const char *token, unsigned int *hash)
+{
+    char head[9];
+    int i;
+
+    for (i = 0; i < SESSION_TOKEN_LEN; i++)
+        if (!isxdigit((unsigned char)token[i]))
+            return -1;
+    if (token[SESSION_TOKEN_LEN] != '\0')
+        return -1;
+    memcpy(head, token, 8);
+    head[8] = '\0';
+    *hash = strtoul(head, NULL, 16);
+    return 0;
+}
+
+static session_shard_t *session_shard(unsigned int hash)
+{
+    return &shards[(hash >> 24) % SESSION_SHARDS];
+}
+
+/* session_init - 初始化会话表 */
+void session_init(void)
+{
+    int i;
+
+    for (i = 0; i < SESSION_SHARDS; i++)
+        pthread_rwlock_init(&shards[i].lock, NULL);
+    last_sweep = session_now();
+}
+
+/*
+ * session_create - 为user创建会话，令牌写入token（至少SESSION_TOKEN_LEN+1字节）。
+ *    成功返回0，无法取得随机数时返回-1。
+ */
+int session_create(const char *user, char *token)
+{
+    unsigned char rnd[SESSION_TOKEN_LEN / 2];
+    unsigned int hash;
+    session_shard_t *sh;
+    session_t *s;
+    int i;
+
+    if (getrandom(rnd, sizeof(rnd), 0) != sizeof(rnd))
+        return -1;
+    for (i = 0; i < (int)sizeof(rnd); i++)
+        sprintf(token + 2 * i, "%02x", rnd[i]);
+    token_hash(token, &hash);
+    sh = session_shard(hash);
+
+    s = Malloc(sizeof(session_t));
+    strcpy(s->token, token);
+    snprintf(s->user, sizeof(s->user), "%s", user);
+    s->expire = session_now() + config.session_ttl;
+
+    pthread_rwlock_wrlock(&sh->lock);
+    s->next = sh->buckets[hash % SESSION_BUCKETS];
+    sh->buckets[hash % SESSION_BUCKETS] = s;
+    sh->count++;
+    pthread_rwlock_unlock(&sh->lock);
+    return 0;
+}
+
+/*
+ * session_check - 令牌是否对应一个未过期的会话。有效时返回1，
+ *    若user不为NULL则复制用户名（至少SESSION_USER_LEN字节）；否则返回0。
+ */
+int session_check(const char *token, char *user)
+{
+    unsigned int hash;
+    session_shard_t *sh;
+    session_t *s;
+    time_t now = session_now();
+    int valid = 0;
+
+    if (token_hash(token, &hash) < 0)
+        return 0;
+    sh = session_shard(hash);
+
+    pthread_rwlock_rdlock(&sh->lock);
+    for (s = sh->buckets[hash % SESSION_BUCKETS]; s; s = s->next)
+        if (!strcmp(s->token, token))
+        {
+            if ((valid = s->expire > now) && user)
+                strcpy(user, s->user);
+            break;
+        }
+    pthread_rwlock_unlock(&sh->lock);
+    return valid;
+}
+
+/* session_destroy - 删除令牌对应的会话（退出登录） */
+void session_destroy(const char *token)
+{
+    unsigned int hash;
+    session_shard_t *sh;
+    session_t **pp, *s;
+
+    if (token_hash(token, &hash) < 0)
+        return;
+    sh = session_shard(hash);
+
+    pthread_rwlock_wrlock(&sh->lock);
+    for (pp = &sh->buckets[hash % SESSION_BUCKETS]; (s = *pp) != NULL; pp = &s->next)
+        if (!strcmp(s->token, token))
+        {
+            *pp = s->next;
+            sh->count--;
+            free(s);
+            break;
+        }
+    pthread_rwlock_unlock(&sh->lock);
+}
+
+/*
+ * session_sweep - 清除过期会话。由反应堆线程在每轮事件循环后调用，
+ *    实际每SESSION_SWEEP秒才扫描一次，每次只锁住一个分片。
+ */
+void session_sweep(void)
+{
+    time_t now = session_now();
+    session_t **pp, *s;
+    int i, b;
+
+    if (now - last_sweep < SESSION_SWEEP)
+        return;
+    last_sweep = now;
+    for (i = 0; i < SESSION_SHARDS; i++)
+    {
+        pthread_rwlock_wrlock(&shards[i].lock);
+        for (b = 0; b < SESSION_BUCKETS && shards[i].count > 0; b++)
+            for (pp = &shards[i].buckets[b]; (s = *pp) != NULL;)
+            {
+                if (s->expire > now)
+                {
+                    pp = &s->next;
+                    continue;
+                }
+                *pp = s->next;
+                shards[i].count--;
+                free(s);
+            }
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+}
@@ -0,0 +1,386 @@
+#ifndef __SEVER_H__
+#define __SEVER_H__
+
+#include "csapp.h"
+
+#define CGI_MAXOUT (1 << 20)  // CGI程序输出的最大字节数
+#define CGI_MAXHDRS 32        // 转发的CGI头部行数上限
+#define DB_PATH "userinfo.db" // 用户数据库文件
+#define DB_BUSY_TIMEOUT 5000  // 数据库被锁时的最长等待时间（毫秒）
+#define SESSION_TOKEN_LEN 32  // 会话令牌的十六进制字符数（128位随机数）
+#define SESSION_USER_LEN 64   // 会话中保存的用户名的最大长度（含结尾'\0'）
+#define HTTP_MAXHDRS 64       // 请求头部行数上限，超出时应答431
+#define HTTP_MAXMETHOD 16     // 请求方法的最大长度，超出时应答501
+#define HTTP_MAXURI 4096      // 请求目标的最大长度，超出时应答414
+#define FORM_MAXFIELDS 32     // 表单或查询串中字段数的上限
+#define ROUTE_MAXPARAMS 8     // 一个路由中路径参数数的上限
+#define ROUTE_MAX 64          // 可注册的路由模式数的上限
+#define ETAG_LEN 24           // ETag（含引号与结尾'\0'）的最大长度
+
+/* 服务器运行参数，由main根据命令行设置 */
+typedef struct
+{
+    int keepalive_timeout; // 连接在反应堆中等待下一个请求的最长时间（秒）
+    int keepalive_max;     // 单个连接最多处理的请求数
+    size_t cache_bytes;    // 静态文件缓存的字节上限，0表示禁用
+    off_t sendfile_min;    // 不小于该大小的文件跳过缓存，直接用sendfile零拷贝发送
+    int session_ttl;       // 登录会话的有效期（秒）
+    int cgi;               // 是否把未注册处理程序的动态请求交给外部CGI程序
+    int fcgi_procs;        // 每个FastCGI上游程序的常驻进程数
+    size_t body_max;       // 请求信息体的字节上限
+    int log_level;         // 日志详细程度，LOG_xxx
+    int log_sample;        // 访问日志的采样间隔，n表示每n个请求记录一个
+    size_t log_rotate;     // 日志文件轮转的字节阈值，0表示不轮转
+    const char *log_path;  // 日志文件路径，NULL表示标准输出
+    int log_hostnames;     // 访问日志是否记录客户端主机名（由后台线程反向解析）
+    int metrics_public;    // /metrics是否对所有客户端开放，否则只应答本机的请求
+} config_t;
+
+/* 日志详细程度 */
+enum
+{
+    LOG_OFF,     // 不记录
+    LOG_ACCESS,  // 每个请求一行访问日志
+    LOG_VERBOSE  // 另外记录连接的建立等调试信息
+};
+
+extern config_t config;
+
+/* 指向缓冲区中一段数据的片段 */
+typedef struct
+{
+    const char *p;
+    size_t len;
+} slice_t;
+
+/* 常用请求头部，解析时按名字直接定位到对应的槽位 */
+typedef enum
+{
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_ACCEPT_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_COOKIE,
+    HDR_TRANSFER_ENCODING,
+    HDR_NKNOWN
+} hdr_id_t;
+
+/* 请求头部解析器（parser.c），解析状态跨越多次读取保存在连接中 */
+typedef struct
+{
+    int state;                       // 解析状态
+    size_t pos;                      // 下次调用从头部起点之后的这一位置继续扫描
+    size_t mark;                     // 正在解析的片段的起点
+    const char *base;                // 上次调用时头部的起点，缓冲区中的数据被移动后据此平移片段
+    int status;                      // 出错时应答的状态码
+    const char *reason;              // 以及原因短语
+    int minor;                       // HTTP/1.x中的x
+    size_t headlen;                  // 完整头部（含结尾空行）的字节数
+    slice_t method, target, version;
+    int nhdrs;                       // 已解析的头部行数
+    unsigned char known[HDR_NKNOWN]; // 常用头部在name/value中的下标加1，0表示请求中没有
+    slice_t name[HTTP_MAXHDRS];      // 头部名与值，头部完整后均以'\0'结尾
+    slice_t value[HTTP_MAXHDRS];
+} http_parser_t;
+
+/* 客户端连接：由反应堆（book_sever.c）创建，请求头部读完整后交给工作线程处理 */
+typedef struct conn
+{
+    int fd;                   // 连接套接字描述符（非阻塞）
+    int nreq;                 // 已处理的请求数
+    time_t expire;            // 在反应堆中等待的截止时间
+    struct conn *prev, *next; // 反应堆空闲链表 / 归还队列中的链接
+    struct reactor *reactor;  // 接受该连接、负责其空闲等待的反应堆
+    rio_t rio;                // 该连接的读缓冲区，跨越反应堆与工作线程两个阶段，可容纳多个流水线请求
+    http_parser_t parser;     // 缓冲区中下一个请求的头部解析状态
+    char peer[64];            // 客户端地址，用于访问日志
+} conn_t;
+
+/* 请求信息体读取器（body.c） */
+typedef struct
+{
+    rio_t *rp;          // 信息体所在连接的读缓冲区
+    int chunked;        // 是否为分块传输编码
+    int expect;         // 客户端在等待100 Continue
+    int eof;            // 信息体已读完（或没有信息体）
+    long long length;   // Content-Length，没有时为-1
+    long long remain;   // 按长度读取时剩余的字节数，分块编码时为当前块剩余的字节数
+    size_t total;       // 已读出的字节数
+    int status;         // 出错时应答的状态码
+    const char *reason; // 以及原因短语
+} body_t;
+
+/* 解码后的表单字段，名字与值都以'\0'结尾 */
+typedef struct
+{
+    const char *name;
+    const char *value;
+    size_t vlen; // 值的长度（值中可能含有解码出的'\0'）
+} form_field_t;
+
+typedef struct
+{
+    form_field_t field[FORM_MAXFIELDS];
+    int n;
+} form_t;
+
+/* 路由支持的请求方法 */
+typedef enum
+{
+    HTTP_GET,
+    HTTP_POST,
+    HTTP_NMETHODS
+} http_method_t;
+
+/* 路由匹配的结果：路由编号与路径参数，参数值位于请求内存池中 */
+typedef struct
+{
+    int route; // 匹配的路由编号，未匹配时为-1
+    const char *name[ROUTE_MAXPARAMS];
+    const char *value[ROUTE_MAXPARAMS];
+    int n;
+} route_params_t;
+
+/* 一个HTTP请求的处理上下文，位于工作线程栈上 */
+typedef struct
+{
+    conn_t *conn;                    // 所属连接
+    int fd;                          // 连接套接字描述符
+    int keepalive;                   // 响应后是否保持连接
+    int accept_enc;                  // 客户端可接受的内容编码集合，以1 << ENC_xxx为位
+    int http11;                      // 客户端是否为HTTP/1.1，决定能否使用分块传输
+    int method;                      // 请求方法，HTTP_xxx
+    const char *path;                // 请求路径（已解码，不含查询串）
+    route_params_t params;           // 路由匹配出的路径参数
+    const http_parser_t *hdrs;       // 请求头部表，在读取信息体之前有效
+    body_t body;                     // 请求信息体
+    char sid[SESSION_TOKEN_LEN + 1]; // Cookie中的会话令牌，没有时为空串
+    char sethdr[MAXLINE];            // 附加到响应中的头部行（如Set-Cookie），为空串时不附加
+    int status;                      // 已发送响应的状态码，0表示尚未应答
+    size_t bytes;                    // 已发送的正文字节数
+} request_t;
+
+/* 响应正文段：内存段（base非NULL）或文件段（base为NULL，由fd、off描述） */
+typedef struct
+{
+    const void *base; // 内存段起始地址
+    size_t len;       // 段长度
+    int owned;        // 内存段是否在发送后由构造器释放
+    int fd;           // 文件段的描述符
+    off_t off;        // 文件段的起始偏移
+} resp_seg_t;
+
+#define RESP_MAXSEGS 16 // 单个响应最多的正文段数
+#define RESP_TAIL 80    // 头部区为resp_send最后补上的Content-length、Connection与空行保留的字节数
+
+/* 响应构造器，位于工作线程栈上 */
+typedef struct
+{
+    request_t *rq;                 // 所属请求
+    int status;                    // 状态码
+    int raw;                       // 头部块是否为预先序列化好的（已含Content-length）
+    int sent;                      // 响应是否已发出（或已开始以分块方式发送）
+    int overflow;                  // 有头部行或正文段因超出容量被丢弃，响应已不完整
+    char hdr[MAXBUF];              // 状态行与头部
+    size_t hdrlen;
+    resp_seg_t segs[RESP_MAXSEGS]; // 正文段
+    int nsegs;
+    size_t bodylen;                // 正文总长度
+} response_t;
+
+/* 内容编码，值越大越优先 */
+enum
+{
+    ENC_IDENTITY, // 不压缩
+    ENC_GZIP,
+#ifdef HAVE_ZSTD
+    ENC_ZSTD,
+#endif
+    ENC_COUNT
+};
+
+/* 缓存的某一编码版本：序列化好的响应头部（不含Connection行和结尾空行）与正文 */
+typedef struct
+{
+    char *hdr;
+    size_t hdrlen;
+    char *body;
+    size_t bodylen;
+} cache_variant_t;
+
+/* 静态文件缓存条目 */
+typedef struct cache_entry
+{
+    char *path;                      // 文件路径（缓存键）
+    unsigned int hash;               // 路径的哈希值
+    off_t size;                      // 以下三项用于判断文件是否已被修改
+    ino_t ino;
+    struct timespec mtime;
+    cache_variant_t var[ENC_COUNT];  // 各编码版本，var[ENC_IDENTITY]为原始内容，未生成的版本body为NULL
+    char etag[ETAG_LEN];             // 本版本原始内容的强ETag
+    size_t charge;                   // 条目占用的字节数
+    int refcnt;                      // 正在使用该条目的线程数
+    int removed;                     // 已移出缓存，引用归零时释放
+    struct cache_entry *hnext;       // 哈希链
+    struct cache_entry *prev, *next; // LRU链表
+} cache_entry_t;
+
+/* 缓存的SQL语句编号 */
+typedef enum
+{
+    DB_LOGIN,       // 按用户名和密码查询用户
+    DB_USER_EXISTS, // 查询用户名是否已注册
+    DB_USER_INSERT, // 插入新用户
+    DB_NSTMTS
+} db_stmt_id_t;
+
+typedef struct db db_t; // 工作线程的数据库连接（db.c）
+
+/* 缓存统计 */
+typedef struct
+{
+    unsigned long hits, misses, evictions;
+    size_t bytes, entries;
+} cache_stats_t;
+
+/* 反应堆 */
+void conn_close(conn_t *c); // 关闭连接并释放其资源
+void conn_idle(conn_t *c);  // 工作线程处理完毕，把连接交还反应堆等待下一个请求
+
+/* 请求处理 */
+void handle_client(void *arg); // 线程池任务，参数为conn_t *
+int doit(conn_t *c);           // 处理一个HTTP请求，返回连接能否继续复用
+void clienterror(request_t *rq, const char *cause, const char *errnum, const char *shortmsg, const char *longmsg);
+void redirect(request_t *rq, const char *location);
+char *cgi_headers(response_t *resp, request_t *rq, char *out, size_t outlen);
+
+/* 请求头部解析 */
+void http_parser_init(http_parser_t *p);
+int http_parse(http_parser_t *p, char *buf, size_t len);
+const char *http_header(const http_parser_t *p, hdr_id_t id);
+const char *http_header_find(const http_parser_t *p, const char *name);
+
+/* 请求信息体 */
+int body_begin(body_t *b, request_t *rq);
+ssize_t body_read(body_t *b, void *buf, size_t n);
+int body_each(body_t *b, int (*fn)(void *arg, const char *data, size_t len), void *arg);
+char *body_buffer(body_t *b, size_t *len);
+int body_discard(body_t *b);
+
+/* 请求内存池 */
+void *arena_alloc(size_t n);
+void arena_reset(void);
+
+/* URL编码的表单与查询串 */
+size_t url_decode(char *dst, const char *src, size_t len);
+int form_parse(form_t *f, const char *s, size_t len);
+const char *form_get(const form_t *f, const char *name);
+
+/* 响应构造器 */
+void resp_init(response_t *r, request_t *rq, int status, const char *reason);
+void resp_init_raw(response_t *r, request_t *rq, int status, const char *hdr, size_t hdrlen);
+void resp_header(response_t *r, const char *fmt, ...);
+void resp_body(response_t *r, const void *buf, size_t len);
+void resp_body_owned(response_t *r, void *buf, size_t len);
+void resp_bodyf(response_t *r, const char *fmt, ...);
+void resp_file(response_t *r, int fd, off_t off, size_t len);
+int resp_send(response_t *r);
+int resp_stream_begin(response_t *r);
+int resp_stream_write(response_t *r, const void *buf, size_t len);
+int resp_stream_end(response_t *r);
+
+/* 进程内动态处理程序：query为'?'之后的查询串，处理程序通过resp构造响应 */
+typedef void (*handler_fn)(request_t *rq, const char *query, response_t *resp);
+
+void handler_init(void);
+void handler_run(handler_fn fn, request_t *rq, const char *query);
+void routes_init(void);
+
+/* 路由表 */
+#define ROUTE_GET (1u << HTTP_GET)
+#define ROUTE_POST (1u << HTTP_POST)
+
+int route_add(unsigned methods, const char *pattern, handler_fn fn);
+handler_fn route_lookup(int method, const char *path, route_params_t *params, unsigned *allow);
+const char *route_param(const request_t *rq, const char *name);
+const char *route_pattern(int id);
+int http_method(const char *name);
+const char *http_method_name(int method);
+void route_allow(unsigned allow, char *buf, size_t size);
+
+/* FastCGI上游 */
+int fcgi_add(const char *spec);
+void fcgi_init(void);
+
+/* 内容编码 */
+const char *encoding_name(int enc);
+int encoding_parse(const char *value);
+int encoding_compressible(const char *filetype);
+ssize_t encoding_compress(int enc, const char *in, size_t len, char **out);
+
+/* 用户数据库 */
+db_t *db_get(void);
+sqlite3_stmt *db_stmt(db_t *db, db_stmt_id_t id);
+int db_step(sqlite3_stmt *stmt);
+const char *db_errmsg(db_t *db);
+
+/* 会话表 */
+void session_init(void);
+int session_create(const char *user, char *token);
+int session_check(const char *token, char *user);
+void session_destroy(const char *token);
+void session_sweep(void);
+
+/* 静态文件缓存 */
+void cache_init(size_t capacity);
+int cache_admits(size_t size);
+cache_entry_t *cache_lookup(const char *path, const struct stat *sbuf);
+cache_entry_t *cache_insert(const char *path, const struct stat *sbuf, cache_variant_t *var, const char *etag);
+void cache_release(cache_entry_t *e);
+void cache_getstats(cache_stats_t *st);
+void etag_compute(const void *body, size_t len, char *tag);
+void etag_identity(const struct stat *sbuf, char *tag);
+
+/* 访问日志 */
+void log_init(void);
+void log_access(const request_t *rq, const char *method, const char *target, long usec);
+void log_verbose(const char *fmt, ...);
+unsigned long log_dropped(void);
+
+/* io_uring后端（uring.c） */
+typedef struct uring uring_t;
+uring_t *uring_open(unsigned entries);
+int uring_register_files(uring_t *u, const int *fds, int n);
+int uring_accept(uring_t *u, int fd, int fixed, int multishot, void *data);
+int uring_recv(uring_t *u, int fd, void *buf, size_t len, void *data);
+int uring_read(uring_t *u, int fd, int fixed, void *buf, size_t len, void *data);
+int uring_timeout(uring_t *u, long msec, void *data);
+int uring_wait(uring_t *u);
+int uring_next(uring_t *u, void **data, int *res, int *more);
+
+/* 客户端主机名的异步反向解析 */
+void resolve_init(void);
+const char *resolve_host(const char *addr, char *buf, size_t size);
+
+/* 运行指标 */
+enum
+{
+    M_CONN_ACCEPTED, // 接受的连接数
+    M_CONN_CLOSED,   // 关闭的连接数
+    M_BYTES_IN,      // 请求头部与信息体的字节数
+    M_BYTES_OUT,     // 响应正文的字节数
+    M_CGI_FORKS,     // 派生的CGI进程数
+    M_NCOUNTERS
+};
+
+void metrics_init(void);
+void metrics_add(int id, unsigned long n);
+void metrics_request(int route, int status, long usec);
+void metrics_sqlite(long usec);
+
+#endif /* __SEVER_H__ */
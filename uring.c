@@ -0,0 +1,297 @@
+#include "sever.h"
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * io_uring后端：直接通过系统调用使用io_uring，不依赖liburing。
+ * 每个反应堆一个环，只由运行该反应堆的线程提交和收割，因此环上的操作无需加锁。
+ * 反应堆把accept、接收请求头部、读取唤醒eventfd与定时器都作为请求放进提交队列，
+ * 一次io_uring_enter提交全部新请求并等待完成事件，多个连接的I/O合并为一次系统调用。
+ * 内核不支持io_uring或缺少所需的操作时uring_open返回NULL，由调用者退回epoll。
+ */
+
+struct uring
+{
+    int fd;                     // io_uring实例
+    int enter_fd;               // io_uring_enter使用的描述符：fd或已注册的环编号
+    unsigned enter_flags;       // 已注册环时含IORING_ENTER_REGISTERED_RING
+    int ring_registered;        // 是否已尝试注册环描述符（须在提交线程中进行）
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_local;          // 已填写的SQE尾部，提交时才对内核可见
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;    // 映射的环形区
+    size_t sq_ring_len, cq_ring_len;
+    struct __kernel_timespec ts; // 定时器请求的超时，须在提交前保持有效
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+/* 检查内核是否支持反应堆用到的全部操作 */
+static int probe_ops(int fd)
+{
+    static const int needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_READ, IORING_OP_TIMEOUT};
+    struct io_uring_probe *probe;
+    size_t len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    int i, ok = 1;
+
+    probe = Calloc(1, len);
+    if (sys_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        ok = 0;
+    for (i = 0; ok && i < (int)(sizeof(needed) / sizeof(needed[0])); i++)
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            ok = 0;
+    free(probe);
+    return ok;
+}
+
+static void uring_unmap(uring_t *u)
+{
+    if (u->sq_ring && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_ring_len);
+    if (u->cq_ring && u->cq_ring != u->sq_ring && u->cq_ring != MAP_FAILED)
+        munmap(u->cq_ring, u->cq_ring_len);
+    if (u->sqes && (void *)u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+}
+
+/*
+ * uring_open - 创建一个提交队列容量为entries的io_uring实例。
+ *    内核不支持io_uring（ENOSYS、被seccomp禁止等）或缺少所需的操作时返回NULL。
+ */
+uring_t *uring_open(unsigned entries)
+{
+    struct io_uring_params p;
+    uring_t *u;
+    char *sq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN; // 完成事件只在进入内核时处理，不打断反应堆线程
+    u = Calloc(1, sizeof(uring_t));
+    if ((u->fd = sys_setup(entries, &p)) < 0) // 5.19之前的内核不认识COOP_TASKRUN
+    {
+        memset(&p, 0, sizeof(p));
+        if ((u->fd = sys_setup(entries, &p)) < 0)
+        {
+            free(u);
+            return NULL;
+        }
+    }
+    if (!(p.features & IORING_FEAT_NODROP) || !probe_ops(u->fd)) // 完成队列溢出时不丢弃事件（5.5）
+    {
+        close(u->fd);
+        free(u);
+        return NULL;
+    }
+    fcntl(u->fd, F_SETFD, FD_CLOEXEC);
+    u->enter_fd = u->fd;
+    u->sq_entries = p.sq_entries;
+
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) // 两个环在同一次映射中
+    {
+        if (u->cq_ring_len > u->sq_ring_len)
+            u->sq_ring_len = u->cq_ring_len;
+        u->cq_ring_len = u->sq_ring_len;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || (void *)u->sqes == MAP_FAILED)
+    {
+        uring_unmap(u);
+        close(u->fd);
+        free(u);
+        return NULL;
+    }
+
+    sq = u->sq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_local = *u->sq_tail;
+    u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+    return u;
+}
+
+/*
+ * uring_register_files - 把fds中的n个描述符注册为固定文件，之后可用下标代替描述符，
+ *    免去每次请求查找与引用计数文件。失败返回-1，调用者继续使用普通描述符。
+ */
+int uring_register_files(uring_t *u, const int *fds, int n)
+{
+    return sys_register(u->fd, IORING_REGISTER_FILES, (void *)fds, n) < 0 ? -1 : 0;
+}
+
+/* 提交所有已填写的SQE，不等待 */
+static int uring_submit(uring_t *u, unsigned min_complete)
+{
+    unsigned submit = u->sq_local - *u->sq_tail;
+    int n;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE); // SQE写完后才对内核可见
+    while ((n = sys_enter(u->enter_fd, submit, min_complete,
+                          u->enter_flags | (min_complete ? IORING_ENTER_GETEVENTS : 0))) < 0)
+    {
+        if (errno == EINTR && min_complete == 0)
+            continue;
+        return -1;
+    }
+    return n;
+}
+
+/* 取一个空闲的SQE并清零，提交队列已满时先提交 */
+static struct io_uring_sqe *get_sqe(uring_t *u)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries &&
+        (uring_submit(u, 0) < 0 || u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries))
+        return NULL;
+    idx = u->sq_local & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local++;
+    return sqe;
+}
+
+/*
+ * uring_accept - 在监听套接字fd（fixed为真时是固定文件的下标）上接受连接，新描述符
+ *    带有O_NONBLOCK与FD_CLOEXEC。multishot为真时一个请求持续产生完成事件（5.19），
+ *    完成事件不再带有more标志时须重新提交。提交队列已满时返回-1。
+ */
+int uring_accept(uring_t *u, int fd, int fixed, int multishot, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(u)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->flags = fixed ? IOSQE_FIXED_FILE : 0;
+    sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long)data;
+    return 0;
+}
+
+/* uring_recv - 从套接字fd接收最多len字节到buf，完成事件的结果为接收的字节数，0表示对端关闭 */
+int uring_recv(uring_t *u, int fd, void *buf, size_t len, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(u)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->user_data = (unsigned long)data;
+    return 0;
+}
+
+/* uring_read - 从描述符fd（fixed为真时是固定文件的下标）读取最多len字节到buf */
+int uring_read(uring_t *u, int fd, int fixed, void *buf, size_t len, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(u)) == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->flags = fixed ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = (unsigned long long)-1; // 不适用偏移量的描述符
+    sqe->user_data = (unsigned long)data;
+    return 0;
+}
+
+/* uring_timeout - msec毫秒后产生一个完成事件（结果为-ETIME），用于定期检查超时 */
+int uring_timeout(uring_t *u, long msec, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(u)) == NULL)
+        return -1;
+    u->ts.tv_sec = msec / 1000;
+    u->ts.tv_nsec = (msec % 1000) * 1000000;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&u->ts;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)data;
+    return 0;
+}
+
+/*
+ * uring_wait - 提交所有新请求并等待至少一个完成事件，一次系统调用完成两者。
+ *    第一次调用时在当前线程中注册环描述符（5.18），此后进入内核不再查找描述符。
+ *    被信号中断返回0，出错返回-1。
+ */
+int uring_wait(uring_t *u)
+{
+    struct io_uring_rsrc_update reg;
+
+    if (!u->ring_registered)
+    {
+        u->ring_registered = 1;
+        memset(&reg, 0, sizeof(reg));
+        reg.offset = -1U; // 由内核选择编号
+        reg.data = u->fd;
+        if (sys_register(u->fd, IORING_REGISTER_RING_FDS, &reg, 1) == 1)
+        {
+            u->enter_fd = reg.offset;
+            u->enter_flags = IORING_ENTER_REGISTERED_RING;
+        }
+    }
+    if (__atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) != *u->cq_head) // 已有未收割的事件，只提交
+        return uring_submit(u, 0) < 0 ? -1 : 0;
+    if (uring_submit(u, 1) < 0)
+        return errno == EINTR || errno == EBUSY ? 0 : -1; // EBUSY：完成队列溢出，先收割
+    return 0;
+}
+
+/*
+ * uring_next - 取出下一个完成事件：提交时的data、结果res（负值为-errno），
+ *    *more为真表示该请求还会产生后续事件（multishot）。没有事件时返回0。
+ */
+int uring_next(uring_t *u, void **data, int *res, int *more)
+{
+    unsigned head = *u->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    cqe = &u->cqes[head & *u->cq_mask];
+    *data = (void *)(unsigned long)cqe->user_data;
+    *res = cqe->res;
+    *more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE); // 事件内容读完后才归还槽位
+    return 1;
+}